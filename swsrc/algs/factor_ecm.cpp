@@ -1,379 +1,2586 @@
 #include "algs/factor_ecm.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <numeric>
 #include <cmath>
+#include <ctime>
+#include <fstream>
 #include <iostream>
-#include <optional>
+#include <sstream>
+#include <tuple>
 #include <vector>
-#include <thread>
 #include <mutex>
 
 #include <gmpxx.h>
 
+#include "algs/mod_arith.h"
+#include "algs/mod_arith_simd.h"
+#include "share/prime_sieve.h"
 #include "share/types.h"
 
-class IntxxRandomGenerator
+// Counters of the calling thread. The curve code adds to them without
+//     locks; a pool task clears them when it starts and moves them into
+//     the result of the run when it ends.
+static thread_local EcmStats thread_stats;
+
+EcmStats& EcmStats::operator+=(const EcmStats& other)
 {
-    private:
-        gmp_randstate_t state;
+    curves_started += other.curves_started;
+    curves_completed += other.curves_completed;
+    stage1_wall += other.stage1_wall;
+    stage1_cpu += other.stage1_cpu;
+    stage2_wall += other.stage2_wall;
+    stage2_cpu += other.stage2_cpu;
+    mulmods += other.mulmods;
+    gcds += other.gcds;
+    return *this;
+}
+
+float64 EcmStats::curves_per_second() const
+{
+    const float64 wall = stage1_wall + stage2_wall;
+    return wall == 0 ? 0 : curves_completed / wall;
+}
+
+static float64 wall_seconds()
+{
+    using namespace std::chrono;
+    return duration<float64>(steady_clock::now().time_since_epoch()).count();
+}
+
+// CPU time of the calling thread only
+static float64 thread_cpu_seconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// SplitMix64 finalizer, spreads close seeds over the whole range
+static uint64 mix_seed(uint64 x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// Returns intxx size in bits
+static usize intxx_size(const intxx& val) {
+    return mpz_sizeinbase(val.get_mpz_t(), 2);
+}
+
+// Lucas chain for multiplication by k with Montgomery's PRAC algorithm.
+//     The chain depends only on k, so it is computed with machine
+//     integers once per prime and then applied to the point.
+namespace prac
+{
+    enum Op : uint8
+    {
+        swap, // d < e: swap A and B
+        rule1, rule2, rule3, rule4, rule5, rule6, rule7, rule8, rule9,
+    };
+
+    // Relative costs of a differential addition and a doubling
+    constexpr float64 add_cost = 6.0;
+    constexpr float64 dbl_cost = 5.0;
+
+    // Candidates for the ratio r / k, the first is 1 / golden ratio
+    constexpr float64 ratios[] = {
+        0.61803398874989485, 0.72360679774997897, 0.58017872829546410,
+        0.63283980608870629, 0.61242994950949500, 0.62018198080741576,
+        0.61721461653440386, 0.61838711383604751, 0.61817587249461669,
+        0.61792149414193305,
+    };
+
+    // Walks the chain for k starting with r = k * ratio. If 'chain' is
+    //     not nullptr, the operations are stored into it.
+    // Returns the cost of the chain
+    static float64 walk(uint64 k, float64 ratio, std::vector<uint8>* chain)
+    {
+        uint64 r = static_cast<uint64>(static_cast<float64>(k) * ratio + 0.5);
+        if (k <= r)
+        {
+            return add_cost * k;
+        }
+
+        uint64 d = k - r;
+        uint64 e = 2 * r - k;
+        float64 cost = dbl_cost + add_cost;
+        auto push = [chain](Op op)
+        {
+            if (chain)
+            {
+                chain->push_back(op);
+            }
+        };
+
+        while (d != e)
+        {
+            if (d < e)
+            {
+                std::swap(d, e);
+                push(swap);
+            }
+            if (d - e <= e / 4 && (d + e) % 3 == 0)
+            {
+                d = (2 * d - e) / 3;
+                e = (e - d) / 2;
+                cost += 3 * add_cost;
+                push(rule1);
+            }
+            else if (d - e <= e / 4 && (d - e) % 6 == 0)
+            {
+                d = (d - e) / 2;
+                cost += add_cost + dbl_cost;
+                push(rule2);
+            }
+            else if ((d + 3) / 4 <= e)
+            {
+                d -= e;
+                cost += add_cost;
+                push(rule3);
+            }
+            else if ((d + e) % 2 == 0)
+            {
+                d = (d - e) / 2;
+                cost += add_cost + dbl_cost;
+                push(rule4);
+            }
+            else if (d % 2 == 0)
+            {
+                d /= 2;
+                cost += add_cost + dbl_cost;
+                push(rule5);
+            }
+            else if (d % 3 == 0)
+            {
+                d = d / 3 - e;
+                cost += 3 * add_cost + dbl_cost;
+                push(rule6);
+            }
+            else if ((d + e) % 3 == 0)
+            {
+                d = (d - 2 * e) / 3;
+                cost += 3 * add_cost + dbl_cost;
+                push(rule7);
+            }
+            else if ((d - e) % 3 == 0)
+            {
+                d = (d - e) / 3;
+                cost += 3 * add_cost + dbl_cost;
+                push(rule8);
+            }
+            else
+            {
+                e /= 2;
+                cost += add_cost + dbl_cost;
+                push(rule9);
+            }
+        }
+
+        return cost;
+    }
+
+    // Builds the cheapest chain for prime k > 2
+    static void build(uint64 k, std::vector<uint8>& chain)
+    {
+        float64 best_ratio = ratios[0];
+        float64 best_cost = walk(k, ratios[0], nullptr);
+        for (float64 ratio : ratios)
+        {
+            float64 cost = walk(k, ratio, nullptr);
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_ratio = ratio;
+            }
+        }
+        chain.clear();
+        walk(k, best_ratio, &chain);
+    }
+}
+
+// Montgomery curve B*y^2 = x^3 + A*x^2 + x over Z/nZ. Only the x
+//     coordinate is tracked, as (X : Z) in projective coordinates, so no
+//     inversion is needed during scalar multiplication. The formulas are
+//     the same as in 'hwsrc/ecm/point_double.sv' and 'point_add.sv'.
+// A24 = (A + 2) / 4 (mod n), already in the field
+// Field -- one of the fields from 'algs/mod_arith.h' or a batch field
+//     from 'algs/mod_arith_simd.h', then every lane is its own curve
+// The temporaries of the formulas live in the curve and are reused by
+//     every operation, so with MpzField they are allocated by the first
+//     operations and never again. A curve belongs to one thread.
+template<typename Field>
+class MontgomeryCurve
+{
+    using Elem = typename Field::Elem;
+
+    const Field& F;
+    Elem A24;
+    mutable Elem t1;
+    mutable Elem t2;
+    mutable Elem t3;
+    mutable Elem t4;
+
+    public:
+        MontgomeryCurve(const Field& F, const Elem& A24)
+            : F(F)
+            , A24(A24)
+        {}
+
+        // Number of calls of F.mul and F.sqr, for the statistics. The
+        //     curve is local to one thread, so a plain counter is enough.
+        mutable int64 mulmods = 0;
+
+        struct Point
+        {
+            Elem X;
+            Elem Z;
+        };
+
+        const Field& field() const
+        {
+            return F;
+        }
+
+        // R = 2 * P
+        void dbl(Point& R, const Point& P) const
+        {
+            F.sub(t1, P.X, P.Z);
+            F.sqr(t1, t1);
+            F.add(t2, P.X, P.Z);
+            F.sqr(t2, t2);
+            F.sub(t3, t2, t1);
+            F.mul(R.X, t1, t2);
+            F.mul(t2, A24, t3);
+            F.add(t2, t2, t1);
+            F.mul(R.Z, t3, t2);
+            mulmods += 5;
+        }
+
+        // R = P + Q, where D = P - Q
+        void add(
+            Point& R,
+            const Point& P,
+            const Point& Q,
+            const Point& D
+        ) const
+        {
+            F.add(t1, Q.X, Q.Z);
+            F.sub(t2, P.X, P.Z);
+            F.mul(t3, t1, t2);
+            F.sub(t1, Q.X, Q.Z);
+            F.add(t2, P.X, P.Z);
+            F.mul(t4, t1, t2);
+            F.add(t1, t3, t4);
+            F.sqr(t1, t1);
+            F.sub(t2, t3, t4);
+            F.sqr(t2, t2);
+            F.mul(t1, D.Z, t1);
+            F.mul(R.Z, D.X, t2);
+            std::swap(R.X, t1);
+            mulmods += 6;
+        }
+
+        // Montgomery ladder, k > 0
+        // R0 = k * P, R1 = (k + 1) * P
+        void ladder(
+            const intxx& k,
+            const Point& P,
+            Point& R0,
+            Point& R1
+        ) const
+        {
+            R0 = P;
+            dbl(R1, P);
+
+            for (usize q = intxx_size(k) - 1; 0 < q; --q)
+            {
+                if (mpz_tstbit(k.get_mpz_t(), q - 1))
+                {
+                    add(R0, R1, R0, P);
+                    dbl(R1, R1);
+                }
+                else
+                {
+                    add(R1, R1, R0, P);
+                    dbl(R0, R0);
+                }
+            }
+        }
+
+        // k > 0
+        Point multiply(const intxx& k, const Point& P) const
+        {
+            Point R0;
+            Point R1;
+            ladder(k, P, R0, R1);
+            return R0;
+        }
+
+        // A = k * A, where 'chain' is built by 'prac::build' for k
+        // T -- scratch points
+        void multiply(
+            Point& A,
+            const std::vector<uint8>& chain,
+            Point (&T)[4]
+        ) const
+        {
+            Point& B = T[0];
+            Point& C = T[1];
+            Point* T1 = &T[2];
+            Point* T2 = &T[3];
+
+            B = A;
+            C = A;
+            dbl(A, A);
+            for (uint8 op : chain)
+            {
+                switch (op)
+                {
+                    case prac::swap:
+                        std::swap(A, B);
+                        break;
+                    case prac::rule1:
+                        add(*T1, A, B, C);
+                        add(*T2, *T1, A, B);
+                        add(B, B, *T1, A);
+                        std::swap(A, *T2);
+                        break;
+                    case prac::rule2:
+                        add(B, A, B, C);
+                        dbl(A, A);
+                        break;
+                    case prac::rule3:
+                        // (B, T1, C) = (T1, C, B)
+                        add(*T1, B, A, C);
+                        std::swap(B, *T1);
+                        std::swap(*T1, C);
+                        break;
+                    case prac::rule4:
+                        add(B, B, A, C);
+                        dbl(A, A);
+                        break;
+                    case prac::rule5:
+                        add(C, C, A, B);
+                        dbl(A, A);
+                        break;
+                    case prac::rule6:
+                        // (C, B, T1) = (B, T1, C)
+                        dbl(*T1, A);
+                        add(*T2, A, B, C);
+                        add(A, *T1, A, A);
+                        add(*T1, *T1, *T2, C);
+                        std::swap(C, B);
+                        std::swap(B, *T1);
+                        break;
+                    case prac::rule7:
+                        add(*T1, A, B, C);
+                        add(B, *T1, A, B);
+                        dbl(*T1, A);
+                        add(A, A, *T1, A);
+                        break;
+                    case prac::rule8:
+                        add(*T1, A, B, C);
+                        add(C, C, A, B);
+                        std::swap(B, *T1);
+                        dbl(*T1, A);
+                        add(A, A, *T1, A);
+                        break;
+                    case prac::rule9:
+                        add(C, C, B, A);
+                        dbl(B, B);
+                        break;
+                }
+            }
+            add(A, A, B, C);
+        }
+};
+
+// Width-w non-adjacent form of k > 0, least significant digit first.
+//     Every digit is 0 or odd with |digit| < 2^(w - 1), and any w
+//     consecutive digits contain at most one nonzero.
+static void wnaf(const intxx& k, int32 w, std::vector<int8>& digits)
+{
+    const usize bits = intxx_size(k);
+    digits.assign(bits + 1, 0);
+    const int32 window = 1 << w;
+
+    // 'carry' is the borrow/carry of the digits already taken out
+    int32 carry = 0;
+    usize q = 0;
+    while (q <= bits)
+    {
+        int32 bit = mpz_tstbit(k.get_mpz_t(), q) + carry;
+        if (bit != 1)
+        {
+            // bit is 0 or 2
+            carry = bit >> 1;
+            ++q;
+            continue;
+        }
+        int32 value = 0;
+        for (int32 j = w - 1; 0 <= j; --j)
+        {
+            value = 2 * value + mpz_tstbit(k.get_mpz_t(), q + j);
+        }
+        value += carry;
+        if (window / 2 <= value)
+        {
+            value -= window;
+            carry = 1;
+        }
+        else
+        {
+            carry = 0;
+        }
+        digits[q] = value;
+        q += w;
+    }
+    while (!digits.empty() && digits.back() == 0)
+    {
+        digits.pop_back();
+    }
+}
+
+// Twisted Edwards curve -x^2 + y^2 = 1 + d*x^2*y^2 over Z/nZ in extended
+//     coordinates (X : Y : Z : T), x = X / Z, y = Y / Z, T = X * Y / Z.
+//     The formulas are dbl-2008-hwcd and add-2008-hwcd-3 of Hisil, Wong,
+//     Carter and Dawson for a = -1. The neutral point is (0 : 1 : 1 : 0).
+// d2 = 2 * d, already in the field
+// Temporaries are kept in the curve as in MontgomeryCurve
+template<typename Field>
+class TwistedEdwardsCurve
+{
+    using Elem = typename Field::Elem;
+
+    const Field& F;
+    Elem d2;
+    mutable Elem A;
+    mutable Elem B;
+    mutable Elem C;
+    mutable Elem D;
+    mutable Elem E;
+    mutable Elem G;
+    mutable Elem H;
 
     public:
-        IntxxRandomGenerator(int32 seed = 7)
+        TwistedEdwardsCurve(const Field& F, const Elem& d2)
+            : F(F)
+            , d2(d2)
+        {
+            F.set(O.X, 0);
+            F.set(O.Y, 1);
+            F.set(O.Z, 1);
+            F.set(O.T, 0);
+        }
+
+        // Number of calls of F.mul and F.sqr, as in MontgomeryCurve
+        mutable int64 mulmods = 0;
+
+        struct Point
+        {
+            Elem X;
+            Elem Y;
+            Elem Z;
+            Elem T;
+        };
+
+        // Point prepared for being added: (Y - X, Y + X, 2 * Z, 2 * d * T)
+        struct Cached
+        {
+            Elem YmX;
+            Elem YpX;
+            Elem Z2;
+            Elem T2d;
+        };
+
+        const Field& field() const
+        {
+            return F;
+        }
+
+        void cache(Cached& R, const Point& P) const
+        {
+            F.sub(R.YmX, P.Y, P.X);
+            F.add(R.YpX, P.Y, P.X);
+            F.add(R.Z2, P.Z, P.Z);
+            F.mul(R.T2d, P.T, d2);
+            ++mulmods;
+        }
+
+        // R = 2 * P, 4M + 4S. T is only needed by an addition, so a
+        //     doubling followed by another doubling skips it.
+        void dbl(Point& R, const Point& P, bool with_T) const
+        {
+            F.sqr(A, P.X);
+            F.sqr(B, P.Y);
+            F.sqr(C, P.Z);
+            F.add(C, C, C);
+            F.add(E, P.X, P.Y);
+            F.sqr(E, E);
+            F.sub(E, E, A);
+            F.sub(E, E, B);
+            F.sub(G, B, A);
+            // With H = -A - B and F = G - C both negated, all the
+            //     coordinates change sign, which is the same point
+            F.add(H, A, B);
+            F.sub(C, C, G);
+            F.mul(R.X, E, C);
+            F.mul(R.Y, G, H);
+            if (with_T)
+            {
+                F.mul(R.T, E, H);
+            }
+            F.mul(R.Z, C, G);
+            mulmods += with_T ? 8 : 7;
+        }
+
+        // R = P + Q or, if 'negate', R = P - Q, 8M
+        void add(
+            Point& R,
+            const Point& P,
+            const Cached& Q,
+            bool negate,
+            bool with_T
+        ) const
         {
-            gmp_randinit_mt(state);
-            gmp_randseed_ui(state, seed);
+            F.sub(A, P.Y, P.X);
+            F.add(B, P.Y, P.X);
+            // -(x, y) = (-x, y) swaps Y - X with Y + X and negates T
+            F.mul(A, A, negate ? Q.YpX : Q.YmX);
+            F.mul(B, B, negate ? Q.YmX : Q.YpX);
+            F.mul(C, P.T, Q.T2d);
+            F.mul(D, P.Z, Q.Z2);
+            // E = B - A, H = B + A, F = D - C, G = D + C
+            F.sub(E, B, A);
+            F.add(B, B, A);
+            if (negate)
+            {
+                F.add(A, D, C);
+                F.sub(C, D, C);
+            }
+            else
+            {
+                F.sub(A, D, C);
+                F.add(C, D, C);
+            }
+            F.mul(R.X, E, A);
+            F.mul(R.Y, C, B);
+            if (with_T)
+            {
+                F.mul(R.T, E, B);
+            }
+            F.mul(R.Z, A, C);
+            mulmods += with_T ? 8 : 7;
         }
 
-        intxx generate(const intxx& min, const intxx& max)
+        // P = k * P, k > 0, with the width-w NAF of k and the odd
+        //     multiples P, 3P, ..., (2^(w - 1) - 1)P
+        // table, digits -- scratch, kept by the caller between calls
+        void multiply(
+            Point& P,
+            const intxx& k,
+            int32 w,
+            std::vector<Cached>& table,
+            std::vector<int8>& digits
+        ) const
         {
-            intxx result;
-            intxx wide = max - min;
-            mpz_urandomm(result.get_mpz_t(), state, wide.get_mpz_t());
-            result += min;
-            return result;
+            wnaf(k, w, digits);
+
+            table.resize(1 << (w - 2));
+            cache(table[0], P);
+            if (1 < table.size())
+            {
+                dbl(R, P, true);
+                cache(P2c, R);
+                cur = P;
+                for (usize q = 1; q < table.size(); ++q)
+                {
+                    add(cur, cur, P2c, false, true);
+                    cache(table[q], cur);
+                }
+            }
+
+            // The top digit is positive
+            usize q = digits.size() - 1;
+            const Cached& top = table[digits[q] / 2];
+            // R = top, back from the cached form
+            if (digits[q] == 1)
+            {
+                R = P;
+            }
+            else
+            {
+                add(R, O, top, false, true);
+            }
+
+            while (0 < q)
+            {
+                --q;
+                const int8 digit = digits[q];
+                const bool last = q == 0;
+                dbl(R, R, digit != 0 || last);
+                if (digit != 0)
+                {
+                    add(
+                        R,
+                        R,
+                        table[std::abs(digit) / 2],
+                        digit < 0,
+                        last
+                    );
+                }
+            }
+            std::swap(P, R);
         }
+
+    private:
+        // The neutral point
+        Point O;
+        // Scratch points of 'multiply'
+        mutable Point R;
+        mutable Point cur;
+        mutable Cached P2c;
 };
 
-static intxx div(const intxx& a, const intxx& b)
+uint64 suyama_sigma(uint64 seed, uint64 index)
+{
+    // 31 bits of stream from the seed above 32 bits of index
+    return ((mix_seed(seed) >> 33) << 32) + (index & 0xffffffffull)
+         + ECM_SIGMA_MIN;
+}
+
+bool suyama_curves(
+    const intxx& n,
+    const std::vector<uint64>& sigmas,
+    std::vector<Curve>& curves,
+    intxx& del
+)
+{
+    const int32 count = sigmas.size();
+    // Suyama: u = s^2 - 5, v = 4s, x0 = u^3 / v^3,
+    //     A24 = (v - u)^3 (3u + v) / (16 u^3 v)
+    // Both share the denominator D = 16 u^3 v^4:
+    //     x0 = 16 u^6 v / D, A24 = (v - u)^3 (3u + v) v^3 / D
+    std::vector<intxx> x0(count);
+    std::vector<intxx> A24(count);
+    std::vector<intxx> D(count);
+    for (int32 q = 0; q < count; ++q)
+    {
+        const intxx s = sigmas[q];
+        const intxx u = (s * s - 5) % n;
+        const intxx v = 4 * s % n;
+        const intxx u3 = u * u % n * u % n;
+        const intxx v3 = v * v % n * v % n;
+        const intxx vu = v - u;
+        x0[q] = 16 * u3 % n * u3 % n * v % n;
+        A24[q] = vu * vu % n * vu % n * (3 * u + v) % n * v3 % n;
+        D[q] = 16 * u3 % n * v3 % n * v % n;
+    }
+
+    // A denominator divisible by n spoils the whole batch, such curves
+    //     are dropped. A proper factor is returned at once.
+    std::vector<int32> good;
+    for (int32 q = 0; q < count; ++q)
+    {
+        const intxx g = gcd(D[q], n);
+        if (g == 1)
+        {
+            good.push_back(q);
+        }
+        else if (g != n)
+        {
+            del = g;
+            return false;
+        }
+    }
+
+    // Montgomery's trick: one inversion for the whole batch,
+    //     prefix[q] = D[good[0]] * ... * D[good[q]]
+    curves.clear();
+    if (good.empty())
+    {
+        return true;
+    }
+    std::vector<intxx> prefix(good.size());
+    prefix[0] = D[good[0]];
+    for (usize q = 1; q < good.size(); ++q)
+    {
+        prefix[q] = prefix[q - 1] * D[good[q]] % n;
+    }
+    intxx inv;
+    mpz_invert(inv.get_mpz_t(), prefix.back().get_mpz_t(), n.get_mpz_t());
+
+    std::vector<Curve> ret(good.size());
+    for (usize q = good.size(); 0 < q--; )
+    {
+        // inv = 1 / prefix[q]
+        const intxx inv_D = 0 < q ? intxx{inv * prefix[q - 1] % n} : inv;
+        inv = inv * D[good[q]] % n;
+        Curve& curve = ret[q];
+        curve.sigma = sigmas[good[q]];
+        curve.x0 = x0[good[q]] * inv_D % n;
+        curve.A24 = A24[good[q]] * inv_D % n;
+        if (curve.x0 < 0)
+        {
+            curve.x0 += n;
+        }
+        if (curve.A24 < 0)
+        {
+            curve.A24 += n;
+        }
+    }
+
+    // A^2 - 4 = 16 * A24 * (A24 - 1) must be invertible
+    for (Curve& curve : ret)
+    {
+        const intxx g = gcd(curve.A24 * (curve.A24 - 1), n);
+        if (g == 1)
+        {
+            curves.push_back(std::move(curve));
+        }
+        else if (g != n)
+        {
+            del = g;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool generate_curves(
+    const intxx& n,
+    uint64 seed,
+    uint64 first,
+    int32 count,
+    std::vector<Curve>& curves,
+    intxx& del
+)
 {
-    intxx q = a / b;
-    intxx r = a % b;
-    if (r != 0 && ((a < 0) ^ (b < 0))) {
-        q -= 1;
+    std::vector<uint64> sigmas(count);
+    for (int32 q = 0; q < count; ++q)
+    {
+        sigmas[q] = suyama_sigma(seed, first + q);
     }
-    return q;
+    return suyama_curves(n, sigmas, curves, del);
 }
 
-static intxx mod(const intxx& a, const intxx& b)
+// Suyama's curve for sigma = s has an a = -1 twisted Edwards form exactly
+//     when (s - 5)(s + 1)(s + 3)(3s - 5) is a square. Those s come from
+//     the points of the elliptic curve
+//         Y^2 = X^3 + 284X^2 + 24960X + 691200,  s = 5 + 480 / X,
+//     which has rank 1 and the generator (80, 2240), that is s = 11.
+// Curves with torsion Z/12 or Z/2 x Z/8 have no a = -1 form over Q, the
+//     Suyama curves come closest: 12 divides their order modulo every p.
+namespace suyama_edwards
 {
-    intxx r = a % b;
-    if (r != 0 && ((a < 0) ^ (b < 0))) {
-        r += b;
+    const intxx a2 = 284;
+    const intxx a4 = 24960;
+    const intxx a6 = 691200;
+
+    // Affine point, 'inf' for the point at infinity
+    struct Point
+    {
+        intxx X;
+        intxx Y;
+        bool inf;
+    };
+
+    // a[q] = 1 / a[q] (mod n) for every q with live[q], by Montgomery's
+    //     trick: one inversion and 3(m - 1) multiplications for m values.
+    //     If the product is not invertible the gcds of the single values
+    //     tell why: a value that is 0 modulo n loses its curve, live[q]
+    //     is cleared, and the rest is inverted again.
+    // Returns false if a value shares a proper factor with n, then it is
+    //     in 'del'
+    static bool invert_all(
+        std::vector<intxx>& a,
+        std::vector<bool>& live,
+        const intxx& n,
+        intxx& del
+    )
+    {
+        // prefix[q] -- product of the live values before q
+        std::vector<intxx> prefix(a.size());
+        intxx acc = 1;
+        for (usize q = 0; q < a.size(); ++q)
+        {
+            if (live[q])
+            {
+                a[q] %= n;
+                prefix[q] = acc;
+                acc = acc * a[q] % n;
+            }
+        }
+        if (acc < 0)
+        {
+            acc += n;
+        }
+
+        intxx inv;
+        if (!mpz_invert(inv.get_mpz_t(), acc.get_mpz_t(), n.get_mpz_t()))
+        {
+            for (usize q = 0; q < a.size(); ++q)
+            {
+                if (!live[q])
+                {
+                    continue;
+                }
+                const intxx g = gcd(a[q], n);
+                if (g == n)
+                {
+                    live[q] = false;
+                }
+                else if (g != 1)
+                {
+                    del = g;
+                    return false;
+                }
+            }
+            return invert_all(a, live, n, del);
+        }
+
+        for (usize q = a.size(); 0 < q--; )
+        {
+            if (live[q])
+            {
+                const intxx t = inv * prefix[q] % n;
+                inv = inv * a[q] % n;
+                a[q] = t;
+            }
+        }
+        return true;
     }
-    return r;
+
+    // R[q] = R[q] + Q[q] (mod n) for every q with use[q] and live[q]. The
+    //     slopes of all the curves share one inversion.
+    // A curve whose slope is not invertible modulo n is lost, live[q] is
+    //     cleared
+    // Returns false if a proper factor of n was found, it is in 'del'
+    static bool add_all(
+        std::vector<Point>& R,
+        const std::vector<Point>& Q,
+        const std::vector<bool>& use,
+        std::vector<bool>& live,
+        const intxx& n,
+        intxx& del
+    )
+    {
+        const usize m = R.size();
+        std::vector<intxx> num(m);
+        std::vector<intxx> den(m);
+        std::vector<bool> slope(m, false);
+        for (usize q = 0; q < m; ++q)
+        {
+            if (!use[q] || !live[q] || Q[q].inf)
+            {
+                continue;
+            }
+            const Point& P = R[q];
+            if (P.inf)
+            {
+                R[q] = Q[q];
+                continue;
+            }
+            if ((P.X - Q[q].X) % n == 0)
+            {
+                if ((P.Y + Q[q].Y) % n == 0)
+                {
+                    R[q].inf = true;
+                    continue;
+                }
+                num[q] = 3 * P.X * P.X + 2 * a2 * P.X + a4;
+                den[q] = 2 * P.Y;
+            }
+            else
+            {
+                num[q] = Q[q].Y - P.Y;
+                den[q] = Q[q].X - P.X;
+            }
+            slope[q] = true;
+        }
+
+        std::vector<bool> inverted = slope;
+        if (!invert_all(den, inverted, n, del))
+        {
+            return false;
+        }
+        for (usize q = 0; q < m; ++q)
+        {
+            if (!slope[q])
+            {
+                continue;
+            }
+            if (!inverted[q])
+            {
+                live[q] = false;
+                continue;
+            }
+            // Q may be R itself, so both are read before R is written
+            const intxx l = den[q] * num[q] % n;
+            const intxx X = (l * l - a2 - R[q].X - Q[q].X) % n;
+            R[q].Y = (l * (R[q].X - X) - R[q].Y) % n;
+            R[q].X = X;
+            R[q].inf = false;
+        }
+        return true;
+    }
+
+    // R[q] = k[q] * (80, 2240) (mod n), k[q] > 0, all in lock-step, so
+    //     every doubling and every addition is one inversion for all q
+    // A curve with R[q] at infinity modulo n is lost, live[q] is cleared
+    // Returns false if a proper factor of n was found, it is in 'del'
+    static bool multiply_all(
+        std::vector<Point>& R,
+        const std::vector<uint64>& k,
+        std::vector<bool>& live,
+        const intxx& n,
+        intxx& del
+    )
+    {
+        const usize m = k.size();
+        const std::vector<Point> G(m, Point{80, 2240, false});
+        const std::vector<bool> all(m, true);
+        std::vector<bool> bit(m);
+        R.assign(m, Point{0, 0, true});
+        for (int32 q = 63; 0 <= q; --q)
+        {
+            if (!add_all(R, R, all, live, n, del))
+            {
+                return false;
+            }
+            for (usize c = 0; c < m; ++c)
+            {
+                bit[c] = (k[c] >> q) & 1;
+            }
+            if (!add_all(R, G, bit, live, n, del))
+            {
+                return false;
+            }
+        }
+        for (usize c = 0; c < m; ++c)
+        {
+            if (R[c].inf)
+            {
+                live[c] = false;
+            }
+        }
+        return true;
+    }
+}
+
+bool generate_edwards_curves(
+    const intxx& n,
+    uint64 seed,
+    uint64 first,
+    int32 count,
+    std::vector<EdwardsCurve>& curves,
+    intxx& del
+)
+{
+    using namespace suyama_edwards;
+
+    std::vector<uint64> k(count);
+    for (int32 q = 0; q < count; ++q)
+    {
+        k[q] = (mix_seed(seed ^ mix_seed(first + q)) >> 1) + 1;
+    }
+    std::vector<bool> live(count, true);
+    std::vector<Point> R;
+    if (!multiply_all(R, k, live, n, del))
+    {
+        return false;
+    }
+
+    // Every step below inverts one value per curve, all at once
+    std::vector<intxx> inv(count);
+    auto invert_step = [&]() {
+        return invert_all(inv, live, n, del);
+    };
+
+    // s = 5 + 480 / X, w = 480 * Y / X^2 is the square root
+    for (int32 q = 0; q < count; ++q)
+    {
+        inv[q] = R[q].X;
+    }
+    if (!invert_step())
+    {
+        return false;
+    }
+    std::vector<intxx> s(count);
+    std::vector<intxx> w(count);
+    std::vector<intxx> u(count);
+    std::vector<intxx> v(count);
+    std::vector<intxx> u3(count);
+    for (int32 q = 0; q < count; ++q)
+    {
+        if (!live[q])
+        {
+            continue;
+        }
+        const intxx& inv_X = inv[q];
+        s[q] = (5 + 480 * inv_X) % n;
+        w[q] = 480 * R[q].Y % n * inv_X % n * inv_X % n;
+
+        // Suyama: u = s^2 - 5, v = 4s, x0 = u^3 / v^3,
+        //     A24 = (v - u)^3 (3u + v) / (16 u^3 v)
+        u[q] = (s[q] * s[q] - 5) % n;
+        v[q] = 4 * s[q] % n;
+        u3[q] = u[q] * u[q] % n * u[q] % n;
+        inv[q] = 16 * u3[q] * v[q] * v[q] * v[q];
+    }
+    if (!invert_step())
+    {
+        return false;
+    }
+    std::vector<intxx> x0(count);
+    std::vector<intxx> A24(count);
+    for (int32 q = 0; q < count; ++q)
+    {
+        if (!live[q])
+        {
+            continue;
+        }
+        // 1 / (16 u^3 v^3) times 16 u^3 for x0, times v^2 for A24
+        const intxx& inv_uv = inv[q];
+        x0[q] = u3[q] * u3[q] % n * 16 % n * inv_uv % n;
+        const intxx vu = v[q] - u[q];
+        A24[q] = vu * vu % n * vu % n * (3 * u[q] + v[q]) % n;
+        A24[q] = A24[q] * v[q] % n * v[q] % n * inv_uv % n;
+
+        // -a = r^2 for a = (A + 2) / B, B = x0^3 + A x0^2 + x0, where
+        //     r = 128 s^4 w / ((s - 1)(s + 5) u^3 (s^2 + 5))
+        inv[q] = (s[q] - 1) * (s[q] + 5) % n * u3[q] % n
+               * (s[q] * s[q] + 5) % n;
+    }
+    if (!invert_step())
+    {
+        return false;
+    }
+    std::vector<intxx> r(count);
+    for (int32 q = 0; q < count; ++q)
+    {
+        if (!live[q])
+        {
+            continue;
+        }
+        const intxx s2 = s[q] * s[q] % n;
+        r[q] = inv[q] * 128 % n * s2 % n * s2 % n * w[q] % n;
+
+        // (x, y) = (u / v, (u - 1) / (u + 1)) from the Montgomery point
+        //     (u, v) = (x0, 1), then x scaled by r to make a = -1:
+        //     d = -(A - 2) / (A + 2) = (1 - A24) / A24
+        inv[q] = (x0[q] + 1) * A24[q];
+    }
+    if (!invert_step())
+    {
+        return false;
+    }
+
+    for (int32 q = 0; q < count; ++q)
+    {
+        if (!live[q])
+        {
+            continue;
+        }
+        EdwardsCurve curve;
+        curve.x0 = x0[q] * r[q] % n;
+        curve.y0 = (x0[q] - 1) * A24[q] % n * inv[q] % n;
+        curve.d = (1 - A24[q]) * (x0[q] + 1) % n * inv[q] % n;
+        curve.mont = {x0[q], A24[q]};
+
+        for (intxx* value : {
+            &curve.x0,
+            &curve.y0,
+            &curve.d,
+            &curve.mont.x0,
+            &curve.mont.A24
+        })
+        {
+            if (*value < 0)
+            {
+                *value += n;
+            }
+        }
+        curves.push_back(std::move(curve));
+    }
+    return true;
+}
+
+bool generate_edwards_curve(
+    const intxx& n,
+    uint64 seed,
+    uint64 index,
+    EdwardsCurve& curve,
+    intxx& del
+)
+{
+    std::vector<EdwardsCurve> curves;
+    if (!generate_edwards_curves(n, seed, index, 1, curves, del))
+    {
+        return false;
+    }
+    if (curves.empty())
+    {
+        del = n;
+        return false;
+    }
+    curve = std::move(curves[0]);
+    return true;
+}
+
+// P = p * P, 'chain' is built by 'prac::build' for odd p
+template<typename ECurve>
+static void multiply_prime(
+    const ECurve& curve,
+    typename ECurve::Point& P,
+    int64 p,
+    const std::vector<uint8>& chain,
+    typename ECurve::Point (&T)[4]
+)
+{
+    if (p == 2)
+    {
+        curve.dbl(P, P);
+    }
+    else
+    {
+        curve.multiply(P, chain, T);
+    }
+}
+
+// Stage 1: P = k(B) / k(B0) * P, where k(B) is the product of all prime
+//     powers not above B. B0 = 1 is the whole stage 1, a larger B0
+//     extends a point that already went through stage 1 to B0. Primes
+//     are streamed one by one, so neither k nor the list of primes is
+//     ever stored.
+// 'stop' is polled before every prime
+// Returns false if stopped
+template<typename ECurve>
+static bool stage1(
+    const ECurve& curve,
+    typename ECurve::Point& P,
+    int64 B0,
+    int64 B,
+    const std::atomic<bool>& stop
+)
+{
+    // The longest chain of a prime below 2^24 has 64 operations and the
+    //     length grows as 3 * log2(p), so this is enough for any B
+    std::vector<uint8> chain;
+    chain.reserve(512);
+    typename ECurve::Point T[4];
+    auto multiply_primes = [&](int64 from, int64 to) {
+        PrimeStream primes(from, to);
+        for (int64 p = primes.next(); p != 0; p = primes.next())
+        {
+            if (stop.load(std::memory_order_relaxed))
+            {
+                return false;
+            }
+            if (p != 2)
+            {
+                prac::build(p, chain);
+            }
+            // p^e, the largest power of p not above B, without the
+            //     powers not above B0 that are already in P
+            for (int64 power = p; ; power *= p)
+            {
+                if (B0 < power)
+                {
+                    multiply_prime(curve, P, p, chain, T);
+                }
+                if (B / p < power)
+                {
+                    break;
+                }
+            }
+        }
+        return true;
+    };
+
+    // Of the primes up to B0 only those up to sqrt(B) get a new power
+    int64 root = static_cast<int64>(std::sqrt(static_cast<double>(B)));
+    while ((root + 1) * (root + 1) <= B)
+    {
+        ++root;
+    }
+    return multiply_primes(2, std::min(B0, root))
+        && multiply_primes(B0 + 1, B);
+}
+
+// Stage 1 on the Edwards form. Prime powers are multiplied together into
+//     chunks of about EDWARDS_CHUNK_BITS bits, and every chunk is one NAF
+//     multiplication, so the table of odd multiples is built once per
+//     chunk and not once per prime.
+// 'stop' is polled before every chunk
+// Returns false if stopped
+constexpr usize EDWARDS_CHUNK_BITS = 1024;
+constexpr int32 EDWARDS_WINDOW = 5;
+
+template<typename ECurve>
+static bool stage1_edwards(
+    const ECurve& curve,
+    typename ECurve::Point& P,
+    int64 B,
+    const std::atomic<bool>& stop
+)
+{
+    PrimeStream primes(2, B);
+    std::vector<typename ECurve::Cached> table;
+    std::vector<int8> digits;
+    intxx chunk = 1;
+    for (int64 p = primes.next(); ; p = primes.next())
+    {
+        if (p != 0)
+        {
+            // p^e, the largest power of p not above B
+            int64 power = p;
+            while (power <= B / p)
+            {
+                power *= p;
+            }
+            chunk *= power;
+            if (intxx_size(chunk) < EDWARDS_CHUNK_BITS)
+            {
+                continue;
+            }
+        }
+
+        if (stop.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+        if (chunk != 1)
+        {
+            curve.multiply(P, chunk, EDWARDS_WINDOW, table, digits);
+            chunk = 1;
+        }
+        if (p == 0)
+        {
+            return true;
+        }
+    }
+}
+
+// Called when all the prime factors of n were found at once, that is
+//     gcd(Z, n) = n. Repeats stage 1 and checks the gcd after each prime
+//     power, so that the factors are separated if their orders differ
+//     in at least one prime factor.
+template<typename ECurve>
+static intxx backtrack(
+    const ECurve& curve,
+    const intxx& n,
+    int64 B,
+    typename ECurve::Point P
+)
+{
+    PrimeStream primes(2, B);
+    std::vector<uint8> chain;
+    typename ECurve::Point T[4];
+    for (int64 p = primes.next(); p != 0; p = primes.next())
+    {
+        if (p != 2)
+        {
+            prac::build(p, chain);
+        }
+        for (int64 power = p; ; power *= p)
+        {
+            multiply_prime(curve, P, p, chain, T);
+            ++thread_stats.gcds;
+            intxx del = gcd(curve.field().get(P.Z), n);
+            if (del == n)
+            {
+                return 0;
+            }
+            if (del != 1)
+            {
+                return del;
+            }
+            if (B / p < power)
+            {
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+// Returns the giant step D for stage 2 for the given bounds
+static int32 stage2_step(int64 B1)
+{
+    if (2 * 2310 <= B1)
+    {
+        return 2310;
+    }
+    if (2 * 210 <= B1)
+    {
+        return 210;
+    }
+    return 30;
+}
+
+// Every prime B1 < p <= B2 is written as p = m * D +- j, where
+//     0 < j < D / 2 and gcd(j, D) = 1. The pairs (m, j) depend only on
+//     the bounds, so they are found once per run and shared by all
+//     curves. One bit per pair, about B2 / 20 bits in total.
+struct Stage2Plan
+{
+    int64 B2 = 0;
+    int32 D = 0;
+    std::vector<int32> js;
+    int64 m_first = 0;
+    int64 m_count = 0;
+    // use[(m - m_first) * js.size() + q] <=> m * D +- js[q] covers a prime
+    std::vector<bool> use;
+};
+
+static Stage2Plan make_stage2_plan(int64 B1, int64 B2)
+{
+    Stage2Plan plan;
+    plan.B2 = B2;
+    plan.D = stage2_step(B1);
+    const int32 D = plan.D;
+    const int32 half_D = D / 2;
+
+    std::vector<int32> j_index(half_D, -1);
+    for (int32 j = 1; j < half_D; j += 2)
+    {
+        if (std::gcd(j, D) == 1)
+        {
+            j_index[j] = plan.js.size();
+            plan.js.push_back(j);
+        }
+    }
+
+    // The first giant step whose window m * D +- D / 2 reaches past B1,
+    //     m = 1 already covers every prime from D / 2 on
+    plan.m_first = std::max<int64>((B1 + half_D) / D, 1);
+    const int64 m_end = (B2 + half_D) / D;
+    if (B2 <= B1 || m_end < plan.m_first)
+    {
+        return plan;
+    }
+    plan.m_count = m_end - plan.m_first + 1;
+    plan.use.resize(plan.m_count * plan.js.size());
+
+    PrimeStream primes(
+        std::max(B1 + 1, plan.m_first * D - half_D + 1),
+        B2
+    );
+    for (int64 p = primes.next(); p != 0; p = primes.next())
+    {
+        // m * D - D / 2 < p < m * D + D / 2
+        const int64 m = (p + half_D) / D;
+        const int32 idx = j_index[std::abs(p - m * D)];
+        if (0 <= idx)
+        {
+            plan.use[(m - plan.m_first) * plan.js.size() + idx] = true;
+        }
+    }
+
+    return plan;
+}
+
+// Stage 2, standard continuation
+// If p * Q = O on the curve over F_p' for p = m * D +- j from the plan,
+//     then x(m * D * Q) = x(j * Q) (mod p'), so p' divides
+//     X(m * D * Q) - x(j * Q) * Z(m * D * Q). All such differences are
+//     accumulated in one product and a single gcd is taken at the end.
+// Baby steps x(j * Q) are normalized to Z = 1 with one inversion, giant
+//     steps m * D * Q are walked with differential additions.
+// 'stop' is polled before every giant step
+// Returns gcd or 1 if nothing was found or stopped.
+template<typename ECurve>
+static intxx stage2(
+    const ECurve& curve,
+    const intxx& n,
+    const typename ECurve::Point& Q,
+    const Stage2Plan& plan,
+    const std::atomic<bool>& stop
+)
+{
+    using Point = typename ECurve::Point;
+    using Elem = decltype(Point::X);
+    const auto& F = curve.field();
+
+    if (plan.m_count == 0)
+    {
+        return 1;
+    }
+    const int32 D = plan.D;
+    const int32 half_D = D / 2;
+    const std::vector<int32>& js = plan.js;
+
+    // Baby steps: odd multiples j * Q, j < D / 2
+    std::vector<Point> baby;
+    {
+        Point Q2;
+        curve.dbl(Q2, Q);
+        Point prev = Q;
+        Point cur = Q;
+        for (int32 j = 1; j < half_D; j += 2)
+        {
+            if (std::gcd(j, D) == 1)
+            {
+                baby.push_back(cur);
+            }
+            // (j + 2) * Q = j * Q + 2 * Q, difference (j - 2) * Q
+            Point next;
+            if (j == 1)
+            {
+                curve.add(next, Q2, cur, Q);
+            }
+            else
+            {
+                curve.add(next, cur, Q2, prev);
+            }
+            prev = std::move(cur);
+            cur = std::move(next);
+        }
+    }
+
+    // Montgomery's simultaneous inversion of all baby step Z
+    std::vector<Elem> x_baby(baby.size());
+    {
+        std::vector<Elem> prefix(baby.size());
+        prefix[0] = baby[0].Z;
+        for (usize q = 1; q < baby.size(); ++q)
+        {
+            F.mul(prefix[q], prefix[q - 1], baby[q].Z);
+        }
+        curve.mulmods += 3 * baby.size() - 2;
+        Elem inv;
+        if (!F.inv(inv, prefix.back()))
+        {
+            ++thread_stats.gcds;
+            return gcd(F.get(prefix.back()), n);
+        }
+        Elem t;
+        for (usize q = baby.size() - 1; 0 < q; --q)
+        {
+            F.mul(t, inv, prefix[q - 1]);
+            F.mul(x_baby[q], baby[q].X, t);
+            F.mul(inv, inv, baby[q].Z);
+        }
+        F.mul(x_baby[0], baby[0].X, inv);
+    }
+
+    // Giant steps: R = m * G, G = D * Q
+    Point G = curve.multiply(D, Q);
+    Point R;
+    Point R_next;
+    curve.ladder(plan.m_first, G, R, R_next);
+    Point R_prev;
+
+    Elem acc;
+    F.set(acc, 1);
+    Elem t;
+
+    for (int64 m = 0; m < plan.m_count; ++m)
+    {
+        if (stop.load(std::memory_order_relaxed))
+        {
+            return 1;
+        }
+
+        const usize base = m * js.size();
+        for (usize q = 0; q < js.size(); ++q)
+        {
+            if (plan.use[base + q])
+            {
+                F.mul(t, x_baby[q], R.Z);
+                F.sub(t, R.X, t);
+                F.mul(acc, acc, t);
+                curve.mulmods += 2;
+            }
+        }
+
+        // (m + 1) * G = m * G + G, difference (m - 1) * G
+        R_prev = std::move(R);
+        R = std::move(R_next);
+        curve.add(R_next, R, G, R_prev);
+    }
+
+    ++thread_stats.gcds;
+    return gcd(F.get(acc), n);
+}
+
+// Everything after stage 1 for one curve, Q = k * P
+template<typename ECurve>
+static std::vector<intxx> finish(
+    const ECurve& curve,
+    const intxx& n,
+    int64 B,
+    const Stage2Plan& plan,
+    const Curve& vals,
+    const typename ECurve::Point& Q,
+    const std::atomic<bool>& stop
+) {
+    using Point = typename ECurve::Point;
+    const auto& F = curve.field();
+
+    // The only gcd of stage 1. Z = 0 (mod p) means that the order of P
+    //     on the curve over F_p divides k.
+    ++thread_stats.gcds;
+    intxx del = gcd(F.get(Q.Z), n);
+    if (del == n)
+    {
+        Point P;
+        F.set(P.X, vals.x0);
+        F.set(P.Z, 1);
+        del = backtrack(curve, n, B, std::move(P));
+    }
+    else if (del == 1)
+    {
+        del = stage2(curve, n, Q, plan, stop);
+    }
+    if (del != 0 && del != 1 && del != n)
+    {
+        return {del, n / del};
+    }
+
+    return {};
+}
+
+// Calls fn with the scalar field for n
+// Odd n up to 1024 bits use the fixed-width Montgomery kernels with the
+//     smallest fitting limb count, anything else falls back to mpz.
+template<typename Fn>
+static std::vector<intxx> with_field(const intxx& n, Fn&& fn)
+{
+    const usize bits = intxx_size(n);
+    if (mpz_odd_p(n.get_mpz_t()))
+    {
+        if (bits <= 128)
+        {
+            return fn(MontField<2>{n});
+        }
+        if (bits <= 256)
+        {
+            return fn(MontField<4>{n});
+        }
+        if (bits <= 512)
+        {
+            return fn(MontField<8>{n});
+        }
+        if (bits <= 1024)
+        {
+            return fn(MontField<16>{n});
+        }
+    }
+    return fn(MpzField{n});
+}
+
+// Stage 1 for the Montgomery curves 'vals' in the lanes of F, Q is set to
+//     k * (x0 : 1). Lanes past vals.size() repeat the first curve.
+// Returns false if stopped
+template<typename Field>
+static bool run_stage1(
+    const Field& F,
+    const std::vector<Curve>& vals,
+    int64 B,
+    typename MontgomeryCurve<Field>::Point& Q,
+    const std::atomic<bool>& stop
+)
+{
+    typename Field::Elem A24;
+    F.set(Q.Z, 1);
+    for (int32 lane = 0; lane < F.lanes; ++lane)
+    {
+        const usize q = static_cast<usize>(lane) < vals.size() ? lane : 0;
+        const Curve& curve_vals = vals[q];
+        F.set_lane(A24, lane, curve_vals.A24);
+        F.set_lane(Q.X, lane, curve_vals.x0);
+    }
+    MontgomeryCurve<Field> curve{F, A24};
+    const bool done = stage1(curve, Q, 1, B, stop);
+    thread_stats.mulmods += curve.mulmods * F.lanes;
+    return done;
+}
+
+// The same for curves that continue from their last stage 1. All the
+//     states share the bound they reached.
+template<typename Field>
+static bool run_stage1(
+    const Field& F,
+    const std::vector<EcmCurveState>& vals,
+    int64 B,
+    typename MontgomeryCurve<Field>::Point& Q,
+    const std::atomic<bool>& stop
+)
+{
+    typename Field::Elem A24;
+    for (int32 lane = 0; lane < F.lanes; ++lane)
+    {
+        const usize q = static_cast<usize>(lane) < vals.size() ? lane : 0;
+        const EcmCurveState& state = vals[q];
+        F.set_lane(A24, lane, state.curve.A24);
+        F.set_lane(Q.X, lane, state.X);
+        F.set_lane(Q.Z, lane, state.Z);
+    }
+    MontgomeryCurve<Field> curve{F, A24};
+    const bool done = stage1(curve, Q, vals[0].B, B, stop);
+    thread_stats.mulmods += curve.mulmods * F.lanes;
+    return done;
+}
+
+// The same for Edwards curves. The result is mapped to the Montgomery
+//     form of the curve, u = (1 + y) / (1 - y), for the gcd and stage 2.
+template<typename Field>
+static bool run_stage1(
+    const Field& F,
+    const std::vector<EdwardsCurve>& vals,
+    int64 B,
+    typename MontgomeryCurve<Field>::Point& Q,
+    const std::atomic<bool>& stop
+)
+{
+    using ECurve = TwistedEdwardsCurve<Field>;
+
+    typename Field::Elem d2;
+    typename ECurve::Point P;
+    F.set(P.Z, 1);
+    for (int32 lane = 0; lane < F.lanes; ++lane)
+    {
+        const usize q = static_cast<usize>(lane) < vals.size() ? lane : 0;
+        const EdwardsCurve& curve_vals = vals[q];
+        F.set_lane(d2, lane, 2 * curve_vals.d);
+        F.set_lane(P.X, lane, curve_vals.x0);
+        F.set_lane(P.Y, lane, curve_vals.y0);
+        F.set_lane(P.T, lane, curve_vals.x0 * curve_vals.y0);
+    }
+    ECurve curve{F, d2};
+    const bool done = stage1_edwards(curve, P, B, stop);
+    thread_stats.mulmods += curve.mulmods * F.lanes;
+    if (!done)
+    {
+        return false;
+    }
+    F.add(Q.X, P.Z, P.Y);
+    F.sub(Q.Z, P.Z, P.Y);
+    return true;
+}
+
+static const Curve& montgomery(const Curve& vals)
+{
+    return vals;
+}
+
+static const Curve& montgomery(const EdwardsCurve& vals)
+{
+    return vals.mont;
+}
+
+static const Curve& montgomery(const EcmCurveState& vals)
+{
+    return vals.curve;
+}
+
+// Keeps the point after stage 1 to B, only a state has room for it
+static void keep_stage1(const Curve&, intxx, intxx, int64)
+{}
+
+static void keep_stage1(const EdwardsCurve&, intxx, intxx, int64)
+{}
+
+static void keep_stage1(EcmCurveState& state, intxx X, intxx Z, int64 B)
+{
+    state.X = std::move(X);
+    state.Z = std::move(Z);
+    state.B = B;
+}
+
+// Marks a curve that went through stage 2 to B2 without a factor
+static void keep_stage2(const Curve&, int64)
+{}
+
+static void keep_stage2(const EdwardsCurve&, int64)
+{}
+
+static void keep_stage2(EcmCurveState& state, int64 B2)
+{
+    state.B2 = B2;
+}
+
+// Runs stage 1 for the curves in all lanes of F at once. The scalars do
+//     not depend on the curve, so the lanes never diverge. Then every
+//     lane is finished alone in the scalar field of its own modulus,
+//     F.modulus(lane): backtracking and stage 2 are cheap next to
+//     stage 1 and branch per curve.
+// found[lane] -- factors of the lane, empty if it did not split. A lane
+//     is skipped when a lane before it has split the same modulus.
+template<typename Field, typename Params>
+static void factor_lanes(
+    const Field& F,
+    int64 B,
+    const Stage2Plan& plan,
+    std::vector<Params>& vals,
+    const std::atomic<bool>& stop,
+    std::vector<std::vector<intxx>>& found
+) {
+    const int32 count = std::min<int32>(vals.size(), F.lanes);
+    found.assign(count, {});
+    thread_stats.curves_started += count;
+
+    float64 wall = wall_seconds();
+    float64 cpu = thread_cpu_seconds();
+    typename MontgomeryCurve<Field>::Point Q;
+    const bool done = run_stage1(F, vals, B, Q, stop);
+    thread_stats.stage1_wall += wall_seconds() - wall;
+    thread_stats.stage1_cpu += thread_cpu_seconds() - cpu;
+    if (!done)
+    {
+        return;
+    }
+
+    for (int32 lane = 0; lane < count; ++lane)
+    {
+        keep_stage1(
+            vals[lane],
+            F.get_lane(Q.X, lane),
+            F.get_lane(Q.Z, lane),
+            B
+        );
+    }
+
+    wall = wall_seconds();
+    cpu = thread_cpu_seconds();
+    for (int32 lane = 0; lane < count; ++lane)
+    {
+        if (stop.load(std::memory_order_relaxed))
+        {
+            break;
+        }
+        const intxx& n = F.modulus(lane);
+        bool split = false;
+        for (int32 q = 0; q < lane && !split; ++q)
+        {
+            split = !found[q].empty() && F.modulus(q) == n;
+        }
+        if (split)
+        {
+            continue;
+        }
+
+        found[lane] = with_field(n, [&](const auto& S) {
+            using Scalar = std::decay_t<decltype(S)>;
+            const Curve& curve_vals = montgomery(vals[lane]);
+            typename Scalar::Elem lane_A24;
+            S.set(lane_A24, curve_vals.A24);
+            MontgomeryCurve<Scalar> lane_curve{S, lane_A24};
+            typename MontgomeryCurve<Scalar>::Point lane_Q;
+            S.set(lane_Q.X, F.get_lane(Q.X, lane));
+            S.set(lane_Q.Z, F.get_lane(Q.Z, lane));
+
+            std::vector<intxx> ret = finish(
+                lane_curve,
+                n,
+                B,
+                plan,
+                curve_vals,
+                lane_Q,
+                stop
+            );
+            thread_stats.mulmods += lane_curve.mulmods;
+            return ret;
+        });
+        if (
+            !found[lane].empty()
+            || !stop.load(std::memory_order_relaxed)
+        )
+        {
+            ++thread_stats.curves_completed;
+        }
+        if (found[lane].empty() && !stop.load(std::memory_order_relaxed))
+        {
+            keep_stage2(vals[lane], plan.B2);
+        }
+    }
+    thread_stats.stage2_wall += wall_seconds() - wall;
+    thread_stats.stage2_cpu += thread_cpu_seconds() - cpu;
+}
+
+// Kernel set by set_ecm_kernel
+static EcmKernel forced_kernel = EcmKernel::automatic;
+
+bool ecm_kernel_supported(EcmKernel kernel)
+{
+    switch (kernel)
+    {
+#if MOD_ARITH_SIMD
+        // The limb count does not change the instruction set
+        case EcmKernel::ifma:
+            return Ifma52Kernel<1>::supported();
+        case EcmKernel::avx2:
+            return Avx2Kernel<1>::supported();
+#endif
+        case EcmKernel::automatic:
+        case EcmKernel::scalar:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void set_ecm_kernel(EcmKernel kernel)
+{
+    forced_kernel = kernel;
+}
+
+// Vector kernel chosen at run time for a modulus size, never automatic
+static EcmKernel select_kernel(const intxx& n)
+{
+    if (forced_kernel == EcmKernel::scalar)
+    {
+        return EcmKernel::scalar;
+    }
+#if MOD_ARITH_SIMD
+    if (mpz_odd_p(n.get_mpz_t()) && intxx_size(n) <= 1024)
+    {
+        if (forced_kernel != EcmKernel::automatic
+            && ecm_kernel_supported(forced_kernel))
+        {
+            return forced_kernel;
+        }
+        if (Ifma52Kernel<1>::supported())
+        {
+            return EcmKernel::ifma;
+        }
+        if (Avx2Kernel<1>::supported())
+        {
+            return EcmKernel::avx2;
+        }
+    }
+#endif
+    (void)n;
+    return EcmKernel::scalar;
+}
+
+// Number of curves one task runs at once
+static int32 kernel_lanes(EcmKernel kernel)
+{
+    switch (kernel)
+    {
+#if MOD_ARITH_SIMD
+        case EcmKernel::ifma:
+            return Ifma52Kernel<1>::W;
+        case EcmKernel::avx2:
+            return Avx2Kernel<1>::W;
+#endif
+        default:
+            return 1;
+    }
+}
+
+// Calls fn with the batch field of 'kernel' for the moduli, one per
+//     lane. The limbs cover the largest of them.
+#if MOD_ARITH_SIMD
+template<template<int32> typename Kernel, typename Fn>
+static void with_batch_field(const std::vector<intxx>& moduli, Fn&& fn)
+{
+    // Limb counts that cover 128, 256, 512 and 1024 bits
+    constexpr int32 L = 128 / Kernel<1>::BITS + 1;
+    usize bits = 0;
+    for (const intxx& n : moduli)
+    {
+        bits = std::max(bits, intxx_size(n));
+    }
+    if (bits <= 128)
+    {
+        fn(MontBatchField<Kernel<L>>{moduli});
+    }
+    else if (bits <= 256)
+    {
+        fn(MontBatchField<Kernel<2 * L>>{moduli});
+    }
+    else if (bits <= 512)
+    {
+        fn(MontBatchField<Kernel<4 * L>>{moduli});
+    }
+    else
+    {
+        fn(MontBatchField<Kernel<8 * L>>{moduli});
+    }
+}
+#endif
+
+// Runs the curves 'vals' with 'kernel', lane q on moduli[q]. The
+//     moduli must all fit 'kernel'.
+// found -- as in factor_lanes
+template<typename Params>
+static void factor(
+    const std::vector<intxx>& moduli,
+    EcmKernel kernel,
+    int64 B,
+    const Stage2Plan& plan,
+    std::vector<Params>& vals,
+    const std::atomic<bool>& stop,
+    std::vector<std::vector<intxx>>& found
+) {
+    auto run = [&](const auto& F) {
+        factor_lanes(F, B, plan, vals, stop, found);
+        return std::vector<intxx>{};
+    };
+    switch (kernel)
+    {
+#if MOD_ARITH_SIMD
+        case EcmKernel::ifma:
+            with_batch_field<Ifma52Kernel>(moduli, run);
+            break;
+        case EcmKernel::avx2:
+            with_batch_field<Avx2Kernel>(moduli, run);
+            break;
+#endif
+        default:
+            // One curve at a time
+            with_field(moduli[0], run);
+            break;
+    }
+}
+
+// The same for curves that all run on n, returns the first factors
+//     found or {} if nothing was found or 'stop' was set
+template<typename Params>
+static std::vector<intxx> factor(
+    const intxx& n,
+    EcmKernel kernel,
+    int64 B,
+    const Stage2Plan& plan,
+    std::vector<Params>& vals,
+    const std::atomic<bool>& stop
+) {
+    std::vector<std::vector<intxx>> found;
+    factor({n}, kernel, B, plan, vals, stop, found);
+    for (std::vector<intxx>& ret : found)
+    {
+        if (!ret.empty())
+        {
+            return std::move(ret);
+        }
+    }
+    return {};
+}
+
+// Rows for a balanced semiprime, the factor has bits / 2 bits. B and C
+//     minimize the expected time (curves needed times time per curve),
+//     measured up to 160-bit n and extrapolated above. Stage 2 runs one
+//     curve at a time while stage 1 runs a whole batch, so B2 = 10 * B
+//     is cheaper overall than the usual 100 * B.
+static std::vector<EcmParams> ecm_table = {
+    // bits         B          B2      C
+    {   32,       100,       1000,     2},
+    {   48,       100,       1000,     2},
+    {   64,       400,       4000,     3},
+    {   80,      1000,      10000,     5},
+    {   96,      5000,      50000,     6},
+    {  112,      8000,      80000,    12},
+    {  128,     15000,     150000,    25},
+    {  144,     30000,     300000,    40},
+    {  160,     60000,     600000,    60},
+    {  192,    250000,    2500000,   150},
+    {  224,   1000000,   10000000,   400},
+    {  256,   3000000,   30000000,  1000},
+    {  320,  11000000,  110000000,  3000},
+    {  400,  43000000,  430000000,  8000},
+};
+
+EcmParams ecm_params(const intxx& n, int32 step)
+{
+    const int32 bits = intxx_size(n);
+    usize row = 0;
+    while (row + 1 < ecm_table.size() && ecm_table[row].bits < bits)
+    {
+        ++row;
+    }
+    row += step;
+    if (row < ecm_table.size())
+    {
+        return ecm_table[row];
+    }
+
+    EcmParams params = ecm_table.back();
+    for (usize q = ecm_table.size() - 1; q < row; ++q)
+    {
+        params.B *= 2;
+        params.B2 *= 2;
+        params.C *= 2;
+    }
+    return params;
+}
+
+bool load_ecm_params(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        return false;
+    }
+
+    std::vector<EcmParams> table;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        EcmParams params;
+        if (!(fields >> params.bits))
+        {
+            // Empty line or comment
+            continue;
+        }
+        if (
+            !(fields >> params.B >> params.B2 >> params.C)
+            || params.B < 2
+            || params.C < 1
+            || (!table.empty() && params.bits <= table.back().bits)
+        )
+        {
+            return false;
+        }
+        table.push_back(params);
+    }
+    if (table.empty())
+    {
+        return false;
+    }
+    ecm_table = std::move(table);
+    return true;
+}
+
+EcmPool::EcmPool(int32 procs)
+{
+    for (int32 q = 0; q < std::max(1, procs); ++q)
+    {
+        threads.emplace_back(&EcmPool::worker, this);
+    }
+}
+
+EcmPool::~EcmPool()
+{
+    {
+        std::lock_guard<std::mutex> g{m};
+        quit = true;
+    }
+    start_cv.notify_all();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+int32 EcmPool::size() const
+{
+    return threads.size();
+}
+
+void EcmPool::run(
+    int32 count,
+    std::atomic<bool>& stop,
+    const std::function<void(int32)>& task
+)
+{
+    std::unique_lock<std::mutex> lock{m};
+    this->task = &task;
+    this->count = count;
+    this->stop = &stop;
+    next.store(0);
+    busy = threads.size();
+    ++generation;
+    start_cv.notify_all();
+    done_cv.wait(lock, [this]() { return busy == 0; });
+}
+
+void EcmPool::worker()
+{
+    uint64 seen = 0;
+    std::unique_lock<std::mutex> lock{m};
+    while (true)
+    {
+        start_cv.wait(lock, [this, seen]() {
+            return quit || generation != seen;
+        });
+        if (quit)
+        {
+            return;
+        }
+        seen = generation;
+        lock.unlock();
+
+        for (int32 q = next++; q < count && !stop->load(); q = next++)
+        {
+            (*task)(q);
+        }
+
+        lock.lock();
+        if (--busy == 0)
+        {
+            done_cv.notify_one();
+        }
+    }
+}
+
+FactorECMReturn factor_ECM_parm(
+    const intxx& n,
+    int64 B,
+    int64 B2,
+    int32 C,
+    uint64 seed,
+    EcmPool& pool,
+    std::atomic<bool>& stop,
+    bool verbose,
+    EcmCurveForm form
+)
+{
+    // Index of the task that found the factor. The first task to swap
+    //     it from -1 owns 'ret'; nobody else touches it.
+    std::atomic<int32> winner{-1};
+    std::vector<intxx> ret;
+    EcmStats stats;
+    std::mutex stats_mutex;
+    const Stage2Plan plan = make_stage2_plan(B, B2);
+    const EcmKernel kernel = select_kernel(n);
+    // Every task runs 'lanes' consecutive curves
+    const int32 lanes = kernel_lanes(kernel);
+    // The Edwards curves are built with divisions by 2, 3 and 5
+    const bool edwards = form == EcmCurveForm::edwards
+                      && gcd(n, intxx{30}) == 1;
+
+    if (verbose)
+    {
+        std::cout << "Factorization with ECM\n"
+                  << "  of n = " << n << " \n"
+                  << "  of size " << intxx_size(n) / 8 << " bytes\n"
+                  << "  B = " << B
+                  << "  B2 = " << B2
+                  << "  numbers of procs = " << pool.size()
+                  << std::endl;
+    }
+
+    auto task = [
+        &n = std::as_const(n),
+        B = B,
+        &plan = plan,
+        kernel = kernel,
+        lanes = lanes,
+        edwards = edwards,
+        C = C,
+        seed = seed,
+        &stop = stop,
+        &winner = winner,
+        &ret = ret,
+        &stats = stats,
+        &stats_mutex = stats_mutex
+    ](int32 q)
+    {
+        thread_stats = {};
+        std::vector<intxx> lret;
+        const int32 first = q * lanes;
+        const int32 last = std::min(C, first + lanes);
+        if (edwards)
+        {
+            std::vector<EdwardsCurve> vals;
+            intxx del;
+            if (!generate_edwards_curves(
+                n,
+                seed,
+                first,
+                last - first,
+                vals,
+                del
+            ))
+            {
+                // The inversion that failed has found a factor
+                lret = {del, n / del};
+            }
+            else if (!vals.empty())
+            {
+                lret = factor(n, kernel, B, plan, vals, stop);
+            }
+        }
+        else
+        {
+            std::vector<Curve> vals;
+            intxx del;
+            if (!generate_curves(n, seed, first, last - first, vals, del))
+            {
+                // The batch inversion has found a factor
+                lret = {del, n / del};
+            }
+            else if (!vals.empty())
+            {
+                lret = factor(n, kernel, B, plan, vals, stop);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            stats += thread_stats;
+        }
+        if (lret.empty())
+        {
+            return;
+        }
+
+        int32 expected = -1;
+        if (winner.compare_exchange_strong(expected, q))
+        {
+            ret = std::move(lret);
+            stop.store(true);
+        }
+    };
+
+    pool.run((C + lanes - 1) / lanes, stop, task);
+
+    if (verbose)
+    {
+        std::cout << "Found {";
+        for (const auto& it : ret)
+        {
+            std::cout << it << " ";
+        }
+        std::cout << "}" << std::endl;
+    }
+    return {
+        ret,
+        B,
+        B2,
+        C,
+        0, // attempts
+        (ret.empty() ? FactorEcmError::no_found : FactorEcmError::success),
+        stats
+    };
 }
 
-static std::optional<intxx> mod_inverse(const intxx& a, const intxx& n)
+// Checkpoint file, all integers big-endian:
+//     magic "FRECMCP1"
+//     n, B, B2, number of curves
+//     for every curve: sigma, B, B2, X, Z
+//     where B, B2, sigma and the count are 8 bytes, and n, X, Z are a
+//     4-byte length followed by the bytes of the number
+namespace checkpoint_io
 {
-    if (gcd(a, n) != 1)
-    {
-        return std::nullopt;
-    }
+    const char magic[8] = {'F', 'R', 'E', 'C', 'M', 'C', 'P', '1'};
 
-    intxx old_r = a; intxx r = n;
-    intxx old_s = 1; intxx s = 0;
-    intxx old_t = 0; intxx t = 1;
-
-    while (r != 0)
+    static void write(std::ostream& out, uint64 value)
     {
-        intxx quotient = div(old_r, r);
-        auto fn = +[](intxx& old, intxx& val, intxx& quotient)
+        char buffer[8];
+        for (int32 q = 0; q < 8; ++q)
         {
-            intxx temp_old = val;
-            intxx temp_var = old - quotient * val;
-            old = temp_old;
-            val = temp_var;
-        };
-        fn(old_r, r, quotient);
-        fn(old_s, s, quotient);
-        fn(old_t, t, quotient);
+            buffer[q] = static_cast<char>(value >> (56 - 8 * q));
+        }
+        out.write(buffer, 8);
     }
 
-    return mod(old_s, n);
-}
-
-// Returns intxx size in bits
-static usize intxx_size(const intxx& val) {
-    return mpz_sizeinbase(val.get_mpz_t(), 2);
-}
-
-static std::vector<int32> sieve_of_eratosthenes(int32 limit)
-{
-    std::vector<bool> is_prime(limit + 1, true);
-    is_prime[0] = is_prime[1] = false;
-
-    for (int q = 2; q <= limit; ++q)
+    static void write(std::ostream& out, const intxx& value)
     {
-        if (is_prime[q])
+        const usize size = (mpz_sizeinbase(value.get_mpz_t(), 2) + 7) / 8;
+        std::vector<char> buffer(size);
+        mpz_export(buffer.data(), nullptr, 1, 1, 1, 0, value.get_mpz_t());
+        char size_buffer[4];
+        for (int32 q = 0; q < 4; ++q)
         {
-            for (int w = 2 * q; w <= limit; w += q)
-            {
-                is_prime[w] = false;
-            }
+            size_buffer[q] = static_cast<char>(size >> (24 - 8 * q));
         }
+        out.write(size_buffer, 4);
+        out.write(buffer.data(), size);
     }
 
-    std::vector<int> primes;
-    for (int i = 2; i <= limit; ++i)
+    static bool read(std::istream& in, uint64& value)
     {
-        if (is_prime[i])
+        unsigned char buffer[8];
+        if (!in.read(reinterpret_cast<char*>(buffer), 8))
         {
-            primes.push_back(i);
+            return false;
         }
-    }
-
-    return primes;
-}
-
-class EllipticCurve
-{
-    intxx a;
-    intxx b;
-    intxx n;
-
-    public:
-        EllipticCurve(intxx a, intxx b, intxx n)
-            : a(std::move(a))
-            , b(std::move(b))
-            , n(std::move(n))
-        {
-            this->a %= this->n;
-            this->b %= this->n;
-        }
-
-        using Point = std::tuple<intxx, intxx>;
-
-        // May return 'std::nullopt' not only in case of an error, but
-        //     also when a divisor is found. In this case, it is stored in
-        //     '*del'. The 'del' parameter may be equal to 'std::nullptr'.
-        //     In this case, 'std::nullopt' will still be returned when a
-        //     divisor is found, but the 'del' parameter will be ignored.
-        std::optional<Point> add(
-            const std::optional<Point>& P,
-            const std::optional<Point>& Q,
-            intxx* del
-        )
+        value = 0;
+        for (int32 q = 0; q < 8; ++q)
         {
-            if (!P.has_value())
-            {
-                return Q;
-            }
-            if (!Q.has_value())
-            {
-                return P;
-            }
-
-            const auto& [x1, y1] = P.value();
-            const auto& [x2, y2] = Q.value();
-            if (x1 == x2 && (y1 + y2) % n == 0)
-            {
-                return std::nullopt;
-            }
-
-            intxx numerator;
-            intxx denominator;
-            if (P == Q)
-            {
-                numerator = (3 * x1 * x1 + a) % n;
-                denominator = (2 * y1) % n;
-            }
-            else
-            {
-                numerator = (y2 - y1) % n;
-                denominator = (x2 - x1) % n;
-            }
-            if (denominator == 0)
-            {
-                return std::nullopt;
-            }
-
-            auto inv = mod_inverse(denominator, n);
-            if (!inv.has_value())
-            {
-                if (del)
-                {
-                    *del = gcd(denominator, n);
-                }
-                return std::nullopt;
-            }
-
-            intxx lam = (numerator * inv.value()) % n;
-            intxx x3 = (lam * lam - x1 - x2) % n;
-            intxx y3 = (lam * (x1 - x3) - y1) % n;
-
-            return Point{x3, y3};
+            value = value << 8 | buffer[q];
         }
+        return true;
+    }
 
-    // For return value policy look at 'add' method.
-    std::optional<Point> multiply(intxx k, const Point& P, intxx* del)
+    static bool read(std::istream& in, int64& value)
     {
-        std::optional<Point> result;
-        std::optional<Point> current = P;
-
-        while (0 < k)
+        uint64 raw;
+        if (!read(in, raw))
         {
-            if ((k & 1) != 0)
-            {
-                result = add(result, current, del);
-            }
-            current = add(current, current, del);
-            k >>= 1;
+            return false;
         }
-
-        return result;
+        value = static_cast<int64>(raw);
+        return true;
     }
-};
 
-Curve generate_curve(const intxx& n) {
-    static IntxxRandomGenerator generator;
-    intxx x0;
-    intxx y0;
-    intxx a;
-    intxx b;
-    while (true)
+    static bool read(std::istream& in, intxx& value)
     {
-        x0 = generator.generate(0, n - 1);
-        y0 = generator.generate(0, n - 1);
-        a  = generator.generate(0, n - 1);
-        b = (y0 * y0 - x0 * x0 * x0 - a * x0) % n;
-        intxx disc = (4 * a * a * a + 27 * b * b) % n;
-        if (gcd(disc, n) == 1)
+        unsigned char size_buffer[4];
+        if (!in.read(reinterpret_cast<char*>(size_buffer), 4))
         {
-            break;
+            return false;
+        }
+        usize size = 0;
+        for (int32 q = 0; q < 4; ++q)
+        {
+            size = size << 8 | size_buffer[q];
         }
+        // Far above any modulus ECM is run on
+        if (1 << 16 < size)
+        {
+            return false;
+        }
+        std::vector<char> buffer(size);
+        if (!in.read(buffer.data(), size))
+        {
+            return false;
+        }
+        mpz_import(value.get_mpz_t(), size, 1, 1, 1, 0, buffer.data());
+        return true;
     }
-    return {x0, y0, a, b};
 }
 
-static std::vector<intxx> factor(
+bool save_ecm_checkpoint(
+    const std::string& path,
     const intxx& n,
-    intxx k,
-    Curve vals
-) {
-    EllipticCurve curve{vals.a, vals.b, n};
-    EllipticCurve::Point P{vals.x0, vals.y0};
-
-    intxx del = 0;
-    auto Q = curve.multiply(std::move(k), P, &del);
-    if (!Q.has_value())
+    int64 B,
+    int64 B2,
+    const std::vector<EcmCurveState>& states
+)
+{
+    // Written aside and renamed over the old file, so a crash in the
+    //     middle leaves the previous checkpoint intact
+    const std::string tmp_path = path + ".tmp";
     {
-        if (del != 0 && del != 1)
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        out.write(checkpoint_io::magic, sizeof(checkpoint_io::magic));
+        checkpoint_io::write(out, n);
+        checkpoint_io::write(out, static_cast<uint64>(B));
+        checkpoint_io::write(out, static_cast<uint64>(B2));
+        checkpoint_io::write(out, static_cast<uint64>(states.size()));
+        for (const EcmCurveState& state : states)
         {
-            if (del != 0 && del != 1)
-            {
-                return {del, n / del};
-            }
+            checkpoint_io::write(out, state.curve.sigma);
+            checkpoint_io::write(out, static_cast<uint64>(state.B));
+            checkpoint_io::write(out, static_cast<uint64>(state.B2));
+            checkpoint_io::write(out, state.X);
+            checkpoint_io::write(out, state.Z);
         }
-        else
+        out.flush();
+        if (!out)
         {
-            // Special case: point at infinity
-            // It may mean that the order of the point divides k
-            // Further verification is required
-            // And he knows what needs to be done...
-            // pass // DEV
+            return false;
         }
     }
-
-    return {};
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
 }
 
-static intxx find_k(int32 B)
+bool load_ecm_checkpoint(
+    const std::string& path,
+    intxx& n,
+    int64& B,
+    int64& B2,
+    std::vector<EcmCurveState>& states
+)
 {
-    intxx k = 1;
-    std::vector<int32> primes = sieve_of_eratosthenes(B);
-    for (int32 p : primes)
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof(checkpoint_io::magic)];
+    if (
+        !in.read(magic, sizeof(magic))
+        || !std::equal(magic, magic + sizeof(magic), checkpoint_io::magic)
+    )
     {
-        int32 power = p;
-        while (power <= B)
-        {
-            k *= p;
-            power *= p;
-        }
+        return false;
     }
-    return k;
-}
 
-int32 predict_B(const intxx& n)
-{
-    int32 bits = intxx_size(n);
-    if (bits < 40)
+    uint64 count;
+    if (
+        !checkpoint_io::read(in, n)
+        || !checkpoint_io::read(in, B)
+        || !checkpoint_io::read(in, B2)
+        || !checkpoint_io::read(in, count)
+        || n < 2
+    )
+    {
+        return false;
+    }
+
+    std::vector<EcmCurveState> loaded;
+    std::vector<uint64> sigmas;
+    for (uint64 q = 0; q < count; ++q)
     {
-        int32 B = 1;
-        for (int q = 0; q < bits / 10; ++q)
+        EcmCurveState state;
+        if (
+            !checkpoint_io::read(in, state.curve.sigma)
+            || !checkpoint_io::read(in, state.B)
+            || !checkpoint_io::read(in, state.B2)
+            || !checkpoint_io::read(in, state.X)
+            || !checkpoint_io::read(in, state.Z)
+        )
         {
-            B += 10;
+            return false;
         }
-        return 100 * B;
+        sigmas.push_back(state.curve.sigma);
+        loaded.push_back(std::move(state));
     }
-    else
+
+    // The curves come back from sigma, they were not singular when they
+    //     were saved, so none is dropped now
+    std::vector<Curve> curves;
+    intxx del;
+    if (
+        !suyama_curves(n, sigmas, curves, del)
+        || curves.size() != loaded.size()
+    )
     {
-        double dbits = static_cast<double>(bits) * std::log(2);
-        return 10000 * std::pow(
-            std::exp(
-                std::sqrt(
-                    std::log(dbits) * std::log(std::log(dbits))
-                )
-            ),
-            0.7
-        );
+        return false;
+    }
+    for (usize q = 0; q < loaded.size(); ++q)
+    {
+        loaded[q].curve = std::move(curves[q]);
     }
+    states = std::move(loaded);
+    return true;
 }
 
 FactorECMReturn factor_ECM_parm(
     const intxx& n,
-    int32 B,
-    int32 C,
-    int32 procs,
+    int64 B,
+    int64 B2,
+    std::vector<EcmCurveState>& states,
+    EcmPool& pool,
     std::atomic<bool>& stop,
-    bool verbose
+    bool verbose,
+    const std::string& checkpoint,
+    int32 checkpoint_interval
 )
 {
-    std::mutex m{};
+    std::atomic<int32> winner{-1};
     std::vector<intxx> ret;
-    int32 curve_num = -1;
-    int32 count = C;
+    EcmStats stats;
+    const Stage2Plan plan = make_stage2_plan(B, B2);
+    const EcmKernel kernel = select_kernel(n);
+    const usize lanes = kernel_lanes(kernel);
+
+    // Every task runs up to 'lanes' consecutive states that reached the
+    //     same bound, [first, last). A state with Z = 0 has lost its
+    //     point, one that is already done with (B, B2) is skipped.
+    std::vector<std::pair<usize, usize>> tasks;
+    for (usize q = 0; q < states.size(); ++q)
+    {
+        const EcmCurveState& state = states[q];
+        if (
+            state.Z == 0
+            || B < state.B
+            || (B == state.B && B2 <= state.B2)
+        )
+        {
+            continue;
+        }
+        if (
+            tasks.empty()
+            || tasks.back().second != q
+            || tasks.back().second - tasks.back().first == lanes
+            || states[tasks.back().first].B != state.B
+        )
+        {
+            tasks.push_back({q, q + 1});
+        }
+        else
+        {
+            ++tasks.back().second;
+        }
+    }
 
-    intxx k = find_k(B);
     if (verbose)
     {
         std::cout << "Factorization with ECM\n"
                   << "  of n = " << n << " \n"
                   << "  of size " << intxx_size(n) / 8 << " bytes\n"
                   << "  B = " << B
-                //   << "  k = " << k // DEV [it is better to ommit]
-                  << "  size of k =  " << intxx_size(k) / 8 << " bytes"
-                  << "  numbers of procs = " << procs
+                  << "  B2 = " << B2
+                  << "  curves = " << states.size()
+                  << "  left = " << tasks.size() << " tasks"
+                  << "  numbers of procs = " << pool.size()
                   << std::endl;
     }
 
+    // Tasks own disjoint ranges of 'states'. They write them back under
+    //     'states_mutex', so the checkpoint never sees a half-written
+    //     state. The same lock guards 'stats'.
+    std::mutex states_mutex;
+    using clock = std::chrono::steady_clock;
+    clock::time_point last_save = clock::now();
+    auto save = [&]() {
+        if (!checkpoint.empty())
+        {
+            save_ecm_checkpoint(checkpoint, n, B, B2, states);
+            last_save = clock::now();
+        }
+    };
+
     auto task = [
         &n = std::as_const(n),
-        &k = std::as_const(k),
-        count = count,
+        B = B,
+        &plan = plan,
+        kernel = kernel,
+        &tasks = tasks,
+        &states = states,
+        &states_mutex = states_mutex,
+        &checkpoint = checkpoint,
+        checkpoint_interval = checkpoint_interval,
+        &last_save = last_save,
+        &save = save,
         &stop = stop,
-        &m = m,
+        &winner = winner,
         &ret = ret,
-        &curve_num = curve_num
-    ]()
+        &stats = stats
+    ](int32 q)
     {
-        for (int q = 0; q < count; ++q)
+        thread_stats = {};
+        const auto first = states.begin() + tasks[q].first;
+        const auto last = states.begin() + tasks[q].second;
+        std::vector<EcmCurveState> vals(first, last);
+        std::vector<intxx> lret = factor(n, kernel, B, plan, vals, stop);
         {
-            Curve vals = generate_curve(n);
-            std::vector<intxx> lret = factor(n, k, std::move(vals));
-
-            std::lock_guard<std::mutex> g{m};
-            if (stop.load())
+            std::lock_guard<std::mutex> lock(states_mutex);
+            std::move(vals.begin(), vals.end(), first);
+            stats += thread_stats;
+            const auto interval = std::chrono::seconds(checkpoint_interval);
+            if (!checkpoint.empty() && interval <= clock::now() - last_save)
             {
-                return;
-            }
-            if (!lret.empty())
-            {
-                ret = std::move(lret);
-                curve_num = q;
-                stop.store(true);
-                return;
+                save();
             }
+        }
+        if (lret.empty())
+        {
+            return;
+        }
 
+        int32 expected = -1;
+        if (winner.compare_exchange_strong(expected, q))
+        {
+            ret = std::move(lret);
+            stop.store(true);
         }
     };
 
-    std::vector<std::thread> threads;
-    for (int q = 0; q < procs; ++q)
-    {
-        threads.push_back(std::thread(task));
-    }
-    for (int q = 0; q < procs; ++q)
+    pool.run(tasks.size(), stop, task);
+
+    if (!checkpoint.empty())
     {
-        threads[q].join();
+        if (ret.empty())
+        {
+            // Done or stopped from outside, either way it can go on
+            //     from here
+            save();
+        }
+        else
+        {
+            std::remove(checkpoint.c_str());
+        }
     }
 
     if (verbose)
@@ -388,56 +2595,213 @@ FactorECMReturn factor_ECM_parm(
     return {
         ret,
         B,
-        C,
+        B2,
+        static_cast<int32>(states.size()),
         0, // attempts
-        (ret.empty() ? FactorEcmError::no_found : FactorEcmError::success)
+        (ret.empty() ? FactorEcmError::no_found : FactorEcmError::success),
+        stats
     };
 }
 
-FactorECMReturn factor_ECM_auto(
+bool ecm_stage1(
+    const intxx& n,
+    EcmCurveState& state,
+    int64 B,
+    const std::atomic<bool>& stop
+)
+{
+    std::vector<EcmCurveState> vals;
+    vals.push_back(std::move(state));
+    bool done = false;
+    with_field(n, [&](const auto& F) -> std::vector<intxx> {
+        using Field = std::decay_t<decltype(F)>;
+        typename MontgomeryCurve<Field>::Point Q;
+        done = run_stage1(F, vals, B, Q, stop);
+        if (done)
+        {
+            keep_stage1(vals[0], F.get(Q.X), F.get(Q.Z), B);
+        }
+        return {};
+    });
+    state = std::move(vals[0]);
+    return done;
+}
+
+FactorECMReturn factor_ECM_parm(
     const intxx& n,
+    int64 B,
+    int64 B2,
+    int32 C,
     int32 procs,
     std::atomic<bool>& stop,
     bool verbose
 )
 {
-    procs = 6;
-    // const int32 B = predict_B(n);
-    const int32 B = 1000000;
-    constexpr int32 C = 10;
-    constexpr int32 attempts = 14;
+    EcmPool pool{std::max(1, procs)};
+    return factor_ECM_parm(
+        n,
+        B,
+        B2,
+        C,
+        ECM_DEFAULT_SEED,
+        pool,
+        stop,
+        verbose
+    );
+}
+
+// Every attempt takes the next row of the table, so a number that was
+//     unlucky with its own row gets larger bounds
+constexpr int32 ECM_ATTEMPTS = 14;
+
+FactorECMReturn factor_ECM_auto(
+    const intxx& n,
+    EcmPool& pool,
+    std::atomic<bool>& stop,
+    bool verbose,
+    const std::string& checkpoint
+)
+{
+    constexpr int32 attempts = ECM_ATTEMPTS;
     if (verbose)
     {
         std::cout << "Start auto factor with ECM" << "\n"
-                  << "procs = " << procs
+                  << "procs = " << pool.size()
                   << std::endl;
     }
-    for (int q = 0; q < attempts; ++q)
+
+    // A checkpoint of the same n goes on from its attempt, the row of
+    //     the table tells which one it was
+    std::vector<EcmCurveState> states;
+    int32 first_attempt = 0;
+    EcmStats stats;
+    if (!checkpoint.empty())
+    {
+        intxx saved_n;
+        int64 saved_B;
+        int64 saved_B2;
+        std::vector<EcmCurveState> saved;
+        if (
+            load_ecm_checkpoint(checkpoint, saved_n, saved_B, saved_B2, saved)
+            && saved_n == n
+        )
+        {
+            for (int32 q = 0; q < attempts; ++q)
+            {
+                const EcmParams params = ecm_params(n, q);
+                if (params.B == saved_B && params.B2 == saved_B2)
+                {
+                    first_attempt = q;
+                    states = std::move(saved);
+                    break;
+                }
+            }
+        }
+        if (verbose && !states.empty())
+        {
+            std::cout << "resume from " << checkpoint << std::endl;
+        }
+    }
+
+    for (int32 q = first_attempt; q < attempts; ++q)
     {
-        int32 cur_B = B << q;
-        int32 cur_C = C << q;
+        const EcmParams params = ecm_params(n, q);
+        if (q != first_attempt || states.empty())
+        {
+            // Whole rounds of curves, no worker idles in the last one
+            const int32 procs = pool.size();
+            const int32 cur_C = (params.C + procs - 1) / procs * procs;
+            std::vector<Curve> curves;
+            intxx del;
+            // a new set of curves for every attempt
+            if (!generate_curves(
+                n,
+                ECM_DEFAULT_SEED + q,
+                0,
+                cur_C,
+                curves,
+                del
+            ))
+            {
+                return {
+                    {del, n / del},
+                    0,
+                    0,
+                    0,
+                    q,
+                    FactorEcmError::success,
+                    stats
+                };
+            }
+            states.clear();
+            for (Curve& curve : curves)
+            {
+                // Before stage 1 the point is (x0 : 1) at the bound 1
+                const intxx x0 = curve.x0;
+                states.push_back({std::move(curve), x0, 1, 1});
+            }
+        }
         if (verbose)
         {
             std::cout << "attempt " << q + 1 << std::endl;
-            std::cout << "B = " << cur_B << std::endl;
-            std::cout << "C = " << cur_C << std::endl;
+            std::cout << "B = " << params.B << std::endl;
+            std::cout << "B2 = " << params.B2 << std::endl;
+            std::cout << "C = " << states.size() << std::endl;
         }
         FactorECMReturn ret = factor_ECM_parm(
             n,
-            cur_B,
-            cur_C,
-            procs,
+            params.B,
+            params.B2,
+            states,
+            pool,
             stop,
-            verbose
+            verbose,
+            checkpoint
         );
+        stats += ret.stats;
         if (!ret.ret.empty())
         {
             ret.attempts = q;
+            ret.stats = stats;
             return ret;
         }
+        // Stopped from outside, the checkpoint keeps this attempt
+        if (stop.load())
+        {
+            break;
+        }
     }
 
-    return {{}, 0, 0, 0, FactorEcmError::no_found};
+    return {{}, 0, 0, 0, 0, FactorEcmError::no_found, stats};
+}
+
+FactorECMReturn factor_ECM_auto(
+    const intxx& n,
+    int32 procs,
+    std::atomic<bool>& stop,
+    bool verbose
+)
+{
+    EcmPool pool{std::max(1, procs)};
+    return factor_ECM_auto(n, pool, stop, verbose);
+}
+
+std::vector<intxx> factor_ECM_mt(
+    const intxx& n,
+    EcmPool& pool,
+    std::atomic<bool>& stop,
+    const std::string& checkpoint
+)
+{
+    constexpr bool verbose = true;
+    FactorECMReturn ret = factor_ECM_auto(
+        n,
+        pool,
+        stop,
+        verbose,
+        checkpoint
+    );
+    return ret.ret;
 }
 
 std::vector<intxx> factor_ECM_mt(
@@ -451,6 +2815,250 @@ std::vector<intxx> factor_ECM_mt(
     return ret.ret;
 }
 
+FactorECMManyReturn factor_ECM_many(
+    const std::vector<intxx>& numbers,
+    EcmPool& pool,
+    std::atomic<bool>& stop,
+    bool verbose
+)
+{
+    FactorECMManyReturn result;
+    result.ret.assign(
+        numbers.size(),
+        {{}, 0, 0, 0, 0, FactorEcmError::no_found}
+    );
+
+    // Where every number is: its attempt and the next curve of it.
+    //     'attempt' reaches ECM_ATTEMPTS when the number is given up.
+    struct Progress
+    {
+        int32 attempt;
+        int32 next;
+        EcmParams params;
+        EcmKernel kernel;
+        bool split;
+    };
+    std::vector<Progress> progress;
+    for (const intxx& n : numbers)
+    {
+        progress.push_back({0, 0, ecm_params(n), select_kernel(n), false});
+    }
+
+    // Curve 'index' of attempt 'attempt' on numbers[number]
+    struct Job
+    {
+        usize number;
+        int32 attempt;
+        int32 index;
+        int64 B;
+        int64 B2;
+        EcmKernel kernel;
+        usize bits;
+    };
+
+    if (verbose)
+    {
+        std::cout << "Factorization of " << numbers.size()
+                  << " numbers with ECM\n"
+                  << "  numbers of procs = " << pool.size()
+                  << std::endl;
+    }
+
+    // Guards 'progress[].split', 'result' and the stats
+    std::mutex m;
+    for (int32 round = 0; !stop.load(); ++round)
+    {
+        std::vector<usize> active;
+        int32 lanes = 1;
+        for (usize q = 0; q < numbers.size(); ++q)
+        {
+            if (!progress[q].split && progress[q].attempt < ECM_ATTEMPTS)
+            {
+                active.push_back(q);
+                lanes = std::max(lanes, kernel_lanes(progress[q].kernel));
+            }
+        }
+        if (active.empty())
+        {
+            break;
+        }
+
+        // Enough curves per number to give every worker full batches,
+        //     but never past the attempt the number is in
+        const int32 want = (pool.size() * lanes + active.size() - 1)
+                         / active.size();
+        std::vector<Job> jobs;
+        for (usize q : active)
+        {
+            Progress& p = progress[q];
+            const int32 count = std::min(want, p.params.C - p.next);
+            for (int32 c = 0; c < count; ++c)
+            {
+                jobs.push_back({
+                    q,
+                    p.attempt,
+                    p.next + c,
+                    p.params.B,
+                    p.params.B2,
+                    p.kernel,
+                    // Size in 128-bit units, the batch field grows with it
+                    (intxx_size(numbers[q]) + 127) / 128
+                });
+            }
+            p.next += count;
+            if (p.next == p.params.C)
+            {
+                ++p.attempt;
+                p.next = 0;
+                p.params = ecm_params(numbers[q], p.attempt);
+            }
+        }
+
+        // Curves that share the kernel, the bounds and the field size
+        //     run in the lanes of one task, the numbers stay sorted
+        auto key = [](const Job& job) {
+            return std::make_tuple(job.kernel, job.B, job.B2, job.bits);
+        };
+        std::stable_sort(
+            jobs.begin(),
+            jobs.end(),
+            [&](const Job& a, const Job& b) { return key(a) < key(b); }
+        );
+        std::vector<std::pair<usize, usize>> tasks;
+        std::vector<Stage2Plan> plans;
+        for (usize q = 0; q < jobs.size(); ++q)
+        {
+            if (
+                tasks.empty()
+                || key(jobs[tasks.back().first]) != key(jobs[q])
+            )
+            {
+                plans.push_back(make_stage2_plan(jobs[q].B, jobs[q].B2));
+            }
+            else if (
+                tasks.back().second - tasks.back().first
+                < static_cast<usize>(kernel_lanes(jobs[q].kernel))
+            )
+            {
+                ++tasks.back().second;
+                continue;
+            }
+            tasks.push_back({q, q + 1});
+        }
+        // plan_of[t] -- index into 'plans' of task t
+        std::vector<usize> plan_of(tasks.size());
+        for (usize t = 1; t < tasks.size(); ++t)
+        {
+            const bool same = key(jobs[tasks[t - 1].first])
+                           == key(jobs[tasks[t].first]);
+            plan_of[t] = plan_of[t - 1] + (same ? 0 : 1);
+        }
+
+        if (verbose)
+        {
+            std::cout << "round " << round + 1
+                      << ": numbers = " << active.size()
+                      << "  curves = " << jobs.size()
+                      << "  tasks = " << tasks.size()
+                      << std::endl;
+        }
+
+        auto task = [&](int32 t)
+        {
+            thread_stats = {};
+            auto report = [&](const Job& job, std::vector<intxx> ret) {
+                std::lock_guard<std::mutex> lock(m);
+                if (!progress[job.number].split)
+                {
+                    progress[job.number].split = true;
+                    result.ret[job.number] = {
+                        std::move(ret),
+                        job.B,
+                        job.B2,
+                        job.index + 1,
+                        job.attempt,
+                        FactorEcmError::success
+                    };
+                }
+            };
+
+            std::vector<intxx> moduli;
+            std::vector<Curve> vals;
+            std::vector<const Job*> owners;
+            for (usize q = tasks[t].first; q < tasks[t].second; ++q)
+            {
+                const Job& job = jobs[q];
+                {
+                    // A number leaves as soon as one of its curves splits it
+                    std::lock_guard<std::mutex> lock(m);
+                    if (progress[job.number].split)
+                    {
+                        continue;
+                    }
+                }
+                const intxx& n = numbers[job.number];
+                std::vector<Curve> curves;
+                intxx del;
+                if (!generate_curves(
+                    n,
+                    ECM_DEFAULT_SEED + job.attempt,
+                    job.index,
+                    1,
+                    curves,
+                    del
+                ))
+                {
+                    report(job, {del, n / del});
+                    continue;
+                }
+                if (!curves.empty())
+                {
+                    moduli.push_back(n);
+                    vals.push_back(std::move(curves[0]));
+                    owners.push_back(&job);
+                }
+            }
+
+            if (!vals.empty())
+            {
+                std::vector<std::vector<intxx>> found;
+                factor(
+                    moduli,
+                    owners[0]->kernel,
+                    owners[0]->B,
+                    plans[plan_of[t]],
+                    vals,
+                    stop,
+                    found
+                );
+                for (usize lane = 0; lane < found.size(); ++lane)
+                {
+                    if (!found[lane].empty())
+                    {
+                        report(*owners[lane], std::move(found[lane]));
+                    }
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(m);
+            result.stats += thread_stats;
+        };
+        pool.run(tasks.size(), stop, task);
+    }
+
+    if (verbose)
+    {
+        usize split = 0;
+        for (const Progress& p : progress)
+        {
+            split += p.split;
+        }
+        std::cout << "Split " << split << " of " << numbers.size()
+                  << " numbers" << std::endl;
+    }
+    return result;
+}
+
 std::vector<intxx> factor_ECM(const intxx& n)
 {
     constexpr int32 procs = 6;
@@ -1,18 +1,23 @@
 #include "algs/factor_qs.h"
 
 #include <algorithm>
+#include <atomic>
 #include <unordered_map>
-#include <execution>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <numeric>
 #include <utility>
 #include <cassert>
-#include <ranges>
+#include <thread>
 #include <vector>
 #include <cmath>
 #include <set>
+#include <string>
 
 #include <gmpxx.h>
 
+#include "share/prime_sieve.h"
 #include "share/types.h"
 
 template<typename T>
@@ -22,6 +27,9 @@ using FactorBase = std::vector<int32>;
 using Factors = std::unordered_map<int32, int32>;
 using SmoothNumber = std::tuple<intxx, intxx, Factors>;
 
+// Type of a sieve array entry, see find_smooth_numbers
+using SieveLog = uint8;
+
 static intxx sqrt_intxx(const intxx& n)
 {
     intxx sqrt_n;
@@ -29,35 +37,107 @@ static intxx sqrt_intxx(const intxx& n)
     return sqrt_n;
 }
 
-static int legendre_symbol(const intxx& a, const intxx& p)
+// Runs fn(worker) on procs threads, worker is from [0, procs) and the
+//     calling thread is worker 0
+template<typename Fn>
+static void run_workers(int32 procs, Fn fn)
+{
+    std::vector<std::thread> threads;
+    for (int32 worker = 1; worker < procs; ++worker)
+    {
+        threads.emplace_back(fn, worker);
+    }
+    fn(0);
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+// Calls fn(q) for every q of [0, count), procs threads take contiguous
+//     parts of the range
+template<typename Fn>
+static void parallel_for(usize count, int32 procs, Fn fn)
+{
+    const usize parts = std::max<usize>(
+        1,
+        std::min<usize>(std::max(procs, 1), count)
+    );
+    run_workers(parts, [&](usize part) {
+        const usize from = count * part / parts;
+        const usize to = count * (part + 1) / parts;
+        for (usize q = from; q < to; ++q)
+        {
+            fn(q);
+        }
+    });
+}
+
+// n mod p, the only multiprecision step of the per-prime arithmetic
+static uint32 mod_ui(const intxx& n, uint32 p)
 {
-    return mpz_legendre(a.get_mpz_t(), p.get_mpz_t());
+    return mpz_fdiv_ui(n.get_mpz_t(), p);
 }
 
-static std::vector<int32> sieve_of_eratosthenes(int32 limit)
+// a^e mod p, p < 2^32, so every product fits into 64 bits
+static uint32 pow_mod(uint64 a, uint64 e, uint32 p)
 {
-    constexpr int reps_count = 10;
-    std::vector<int32> primes;
-    for (int32 q = 0; q < limit; ++q) {
-        intxx num = q;
-        bool is_prime = mpz_probab_prime_p(num.get_mpz_t(), reps_count);
-        if (is_prime) {
-            primes.push_back(q);
+    uint64 r = 1 % p;
+    a %= p;
+    while (e)
+    {
+        if (e & 1)
+        {
+            r = r * a % p;
         }
+        a = a * a % p;
+        e >>= 1;
     }
+    return r;
+}
 
-    return primes;
+// Legendre symbol (n / p) for a prime p by Euler's criterion. For p = 2
+//     it is the Kronecker symbol, the value mpz_legendre gives.
+static int32 legendre_symbol(const intxx& n, uint32 p)
+{
+    if (p == 2)
+    {
+        const uint32 r = mod_ui(n, 8);
+        if (r % 2 == 0)
+        {
+            return 0;
+        }
+        return r == 1 || r == 7 ? 1 : -1;
+    }
+    const uint32 e = pow_mod(mod_ui(n, p), (p - 1) / 2, p);
+    if (e == 0)
+    {
+        return 0;
+    }
+    return e == 1 ? 1 : -1;
 }
 
-static std::vector<int32> find_factor_base(const intxx& n, int32 B)
+// Primes p < B with (n / p) = 1
+static std::vector<int32> find_factor_base(
+    const intxx& n, int32 B, int32 procs
+)
 {
-    std::vector<int32> primes = sieve_of_eratosthenes(B);
+    if (B < 3)
+    {
+        return {};
+    }
+    std::vector<uint32> primes = sieve_primes(2, B - 1, procs);
+    std::vector<int32> symbols(primes.size());
+    parallel_for(primes.size(), procs, [&](usize q) {
+        symbols[q] = legendre_symbol(n, primes[q]);
+    });
+
     std::vector<int32> factor_base;
-    for (int32 p : primes)
+    for (usize q = 0; q < primes.size(); ++q)
     {
-        if (legendre_symbol(n, p) == 1)
+        if (symbols[q] == 1)
         {
-            factor_base.push_back(p);
+            factor_base.push_back(primes[q]);
         }
     }
     return factor_base;
@@ -73,176 +153,187 @@ static intxx integer_power(intxx a, int32 power)
     return b;
 }
 
-static intxx field_sqrt(intxx n, int32 p)
+// x with x^2 = a (mod p) by Tonelli-Shanks, p is an odd prime and
+//     (a / p) = 1
+static uint32 sqrt_mod(uint32 a, uint32 p)
 {
-    assert(2 < p && p % 2 == 1); // DEV
-    assert(integer_power(n, (p - 1) / 2) % p == 1); // DEV
-
     if (p % 4 == 3)
     {
-        return integer_power(n, (p + 1) / 4) % p;
+        return pow_mod(a, (p + 1) / 4, p);
     }
 
-    int32 s = 0;
-    int32 q = p - 1;
+    // p - 1 = q * 2^s, q is odd
+    uint32 s = 0;
+    uint32 q = p - 1;
     while (q % 2 == 0)
     {
         ++s;
         q >>= 1;
     }
 
-    int32 z = 2;
-    while ((integer_power(z, (p - 1) / 2) % p) != p - 1)
+    uint32 z = 2;
+    while (pow_mod(z, (p - 1) / 2, p) != p - 1)
     {
         ++z;
     }
 
-    intxx c = integer_power(z, q) % p;
-    intxx r = integer_power(n, (q + 1) / 2) % p;
-    intxx t = integer_power(n, q) % p;
-
-    int32 m = s;
+    uint64 c = pow_mod(z, q, p);
+    uint64 r = pow_mod(a, (q + 1) / 2, p);
+    uint64 t = pow_mod(a, q, p);
+    uint32 m = s;
     while (t != 1)
     {
-        int i = 1;
-        intxx temp = t;
-        for (; i < m; ++i)
+        // The least i with t^(2^i) = 1, 0 < i < m
+        uint32 i = 0;
+        for (uint64 temp = t; temp != 1; temp = temp * temp % p)
         {
-            temp = (temp * temp) % p;
-            if (temp == 1)
-            {
-                break;
-            }
+            ++i;
         }
-        if (i == 0)
+
+        uint64 b = c;
+        for (uint32 k = i + 1; k < m; ++k)
         {
-            break;
+            b = b * b % p;
         }
-
-        intxx b = integer_power(c, 1 << (m - i - 1)) % p;
-        r = (r * b) % p;
-        t = (t * b * b) % p;
-        c = (b * b) % p;
+        r = r * b % p;
+        c = b * b % p;
+        t = t * c % p;
         m = i;
     }
 
     return r;
 }
 
-// Q(x) = (x + m)^2 - n = 0 (mod p) => (x + m)^2 = n (mod p), m = sqrt_n
-static std::vector<intxx> find_Qx_roots(
+// Indices of a polynomial's sieve array where p starts to divide Q(x),
+//     the array begins at x = -M. start2 is -1 if there is only one
+//     root, both are -1 if p divides A and the prime is not sieved.
+struct SieveRoots
+{
+    int32 start1;
+    int32 start2;
+};
+
+// t with t^2 = n (mod p) for every prime of the factor base, the roots
+//     of every polynomial are derived from them
+static std::vector<uint32> find_sqrt_n_mod_p(
     const intxx& n,
-    const intxx& sqrt_n,
-    int32 p
+    int32 procs,
+    const FactorBase& factor_base
 )
 {
-    if (p == 2)
-    {
-        if (n % 2 == 1)
-        {
-            return {0};
-        }
-        else
-        {
-            return {};
-        }
-    }
-
-    if (legendre_symbol(n, p) != 1)
-    {
-        return {};
-    }
-
-    intxx t = field_sqrt(n % p, p);
-
-    intxx root1 = (t - sqrt_n)  % p;
-    intxx root2 = (-t - sqrt_n) % p;
+    std::vector<uint32> sqrts(factor_base.size());
+    parallel_for(factor_base.size(), procs, [&](usize q) {
+        const uint32 p = factor_base[q];
+        sqrts[q] = p == 2 ? mod_ui(n, 2) : sqrt_mod(mod_ui(n, p), p);
+    });
+    return sqrts;
+}
 
-    if (root1 == root2)
+// a^(-1) mod p by the extended Euclidean algorithm, gcd(a, p) = 1
+static uint32 inv_mod(uint32 a, uint32 p)
+{
+    int64 r0 = p;
+    int64 r1 = a % p;
+    int64 s0 = 0;
+    int64 s1 = 1;
+    while (r1)
     {
-        return {root1};
+        const int64 q = r0 / r1;
+        std::tie(r0, r1) = std::make_pair(r1, r0 - q * r1);
+        std::tie(s0, s1) = std::make_pair(s1, s0 - q * s1);
     }
-    return {root1, root2};
+    return s0 < 0 ? s0 + p : s0;
 }
 
+// Rows of bits, bit c of a row is bit c % 64 of word c / 64
+using BitMatrix = std::vector<std::vector<uint64>>;
+
+// Gaussian elimination over GF(2), rows below the pivot rows are reduced
+//     to zero where possible. history[r] is the set of rows of 'matrix'
+//     that the reduced row r is the sum of.
 static std::pair<
-    Matrix<int32>,
-    Matrix<int32>
+    BitMatrix,
+    BitMatrix
 > gaussian_elimination_mod2_prepare(const Matrix<int32>& matrix)
 {
-    int32 m = matrix.size();
-    int32 n = matrix[0].size();
-
-    Matrix<int32> A{matrix};
-    Matrix<int32> row_ops(m, std::vector<int32>{});
+    const usize m = matrix.size();
+    const usize n = m ? matrix[0].size() : 0;
 
-    for (int32 col = 0; col < n; ++col)
+    BitMatrix A(m, std::vector<uint64>((n + 63) / 64, 0));
+    BitMatrix history(m, std::vector<uint64>((m + 63) / 64, 0));
+    for (usize row = 0; row < m; ++row)
     {
-        const int32 UNDEF = std::max(n, m) + 7; // unreachable value
-                                                //            for pivot
-        int32 pivot = UNDEF;
-        for (int32 row = col; row < m; ++row)
+        for (usize col = 0; col < n; ++col)
         {
-            if (A[row][col] == 1)
+            if (matrix[row][col] & 1)
             {
-                pivot = row;
-                break;
+                A[row][col / 64] |= uint64(1) << (col % 64);
             }
         }
-        if (pivot == UNDEF)
+        history[row][row / 64] |= uint64(1) << (row % 64);
+    }
+
+    usize rank = 0;
+    for (usize col = 0; col < n && rank < m; ++col)
+    {
+        const usize word = col / 64;
+        const uint64 bit = uint64(1) << (col % 64);
+        usize pivot = rank;
+        while (pivot < m && !(A[pivot][word] & bit))
         {
-            continue;
+            ++pivot;
         }
-        if (pivot != col)
+        if (pivot == m)
         {
-            std::swap(A[col], A[pivot]);
-            std::swap(row_ops[col], row_ops[pivot]);
+            continue;
         }
+        std::swap(A[rank], A[pivot]);
+        std::swap(history[rank], history[pivot]);
 
-        for (int32 row = 0; row < m; ++row)
+        // The rows below the pivot are zero in the columns before 'col'
+        for (usize row = rank + 1; row < m; ++row)
         {
-            if (row != col && A[row][col] == 1)
+            if (A[row][word] & bit)
             {
-                for (int32 c = 0; c < n; ++c)
+                for (usize w = word; w < A[row].size(); ++w)
+                {
+                    A[row][w] ^= A[rank][w];
+                }
+                for (usize w = 0; w < history[row].size(); ++w)
                 {
-                    A[row][c] ^= A[col][c];
+                    history[row][w] ^= history[rank][w];
                 }
-                row_ops[row].push_back(col);
             }
         }
+        ++rank;
     }
 
-    return {A, row_ops};
+    return {A, history};
 }
 
+// Every zero row gives a dependency, the rows of its history sum to zero
 static Matrix<int32> gaussian_elimination_mod2_find_dependencies(
-    const Matrix<int32>& A,
-    const Matrix<int32>& row_ops
+    const BitMatrix& A,
+    const BitMatrix& history
 )
 {
     Matrix<int32> dependencies;
-    for (int32 q = 0; q < static_cast<int32>(A.size()); ++q)
+    for (usize q = 0; q < A.size(); ++q)
     {
-        bool cond = true;
-        for (auto x : A[q])
-        {
-            if (x != 0)
-            {
-                cond = false;
-                break;
-            }
-        }
+        bool cond = std::all_of(
+            A[q].begin(),
+            A[q].end(),
+            [](uint64 word) { return word == 0; }
+        );
         if (cond)
         {
-            std::set<int32> dep{q};
-            for (auto op : row_ops[q])
-            {
-                dep.insert(op);
-            }
             std::vector<int32> lis;
-            for (int32 op : dep)
+            for (usize w = 0; w < history[q].size(); ++w)
             {
-                lis.push_back(op);
+                for (uint64 bits = history[q][w]; bits; bits &= bits - 1)
+                {
+                    lis.push_back(64 * w + __builtin_ctzll(bits));
+                }
             }
             dependencies.push_back(std::move(lis));
         }
@@ -252,11 +343,23 @@ static Matrix<int32> gaussian_elimination_mod2_find_dependencies(
 
 static Matrix<int32> gaussian_elimination_mod2(const Matrix<int32>& matrix)
 {
-    auto [A, row_ops] = gaussian_elimination_mod2_prepare(matrix);
-    return gaussian_elimination_mod2_find_dependencies(A, row_ops);
+    auto [A, history] = gaussian_elimination_mod2_prepare(matrix);
+    return gaussian_elimination_mod2_find_dependencies(A, history);
 }
 
-static Factors factor_over_base(intxx num, const FactorBase& factor_base)
+// Factors Q(x) over the factor base, Q(x) is smooth if the cofactor,
+//     the part of |Q(x)| without factors from the base, is 1
+// idx -- index of x in the sieve array, p divides Q(x) only if idx is a
+//     root of Q mod p, so the other primes are skipped with machine
+//     arithmetic and only real divisors touch the multiprecision value
+// roots -- roots of the polynomial, primes without them are always tried
+static Factors factor_over_base(
+    const intxx& num,
+    int32 idx,
+    const FactorBase& factor_base,
+    const std::vector<SieveRoots>& roots,
+    intxx& cofactor
+)
 {
     Factors factors;
     intxx temp = abs(num);
@@ -266,111 +369,1098 @@ static Factors factor_over_base(intxx num, const FactorBase& factor_base)
         factors[-1] = 1;
     }
 
-    for (auto p : factor_base)
+    for (usize q = 0; q < factor_base.size() && temp != 1; ++q)
     {
-        if (p == -1)
+        const int32 p = factor_base[q];
+        const int32 r = idx % p;
+        if (0 <= roots[q].start1
+            && r != roots[q].start1
+            && r != roots[q].start2)
         {
             continue;
         }
-        while (temp % p == 0)
+        while (mpz_divisible_ui_p(temp.get_mpz_t(), p))
         {
-            factors[p] = factors.count(p) ? factors[p] + 1 : 0;
-            temp /= p;
+            ++factors[p];
+            mpz_divexact_ui(temp.get_mpz_t(), temp.get_mpz_t(), p);
         }
     }
 
-    if (temp != 1)
+    cofactor = std::move(temp);
+    return factors;
+}
+
+// Relations found by the sieve workers. A push is a lock-free prepend
+//     to a singly linked list, the list is taken whole at the end.
+template<typename Relation>
+class RelationQueue
+{
+    struct Node
     {
-        return {};
+        Relation relation;
+        Node* next;
+    };
+
+    std::atomic<Node*> head = nullptr;
+
+    public:
+        RelationQueue() = default;
+        RelationQueue(const RelationQueue&) = delete;
+        RelationQueue& operator=(const RelationQueue&) = delete;
+
+        ~RelationQueue()
+        {
+            take_all();
+        }
+
+        void push(Relation&& relation)
+        {
+            Node* node = new Node{
+                std::move(relation),
+                head.load(std::memory_order_relaxed)
+            };
+            while (!head.compare_exchange_weak(
+                node->next,
+                node,
+                std::memory_order_release,
+                std::memory_order_relaxed
+            ))
+            {}
+        }
+
+        // Takes all relations pushed so far, in no particular order
+        std::vector<Relation> take_all()
+        {
+            Node* node = head.exchange(nullptr, std::memory_order_acquire);
+            std::vector<Relation> relations;
+            while (node)
+            {
+                relations.push_back(std::move(node->relation));
+                Node* next = node->next;
+                delete node;
+                node = next;
+            }
+            return relations;
+        }
+};
+
+// A relation whose Q(x) is smooth but for one or two primes above the
+//     factor base, large2 is 1 if there is only one
+struct PartialRelation
+{
+    SmoothNumber relation;
+    int64 large1;
+    int64 large2;
+};
+
+// A nontrivial factor of the odd composite c by Pollard's rho with
+//     Brent's cycle detection, 0 if no polynomial x^2 + a splits it
+static uint64 pollard_rho(uint64 c)
+{
+    using uint128 = unsigned __int128;
+    constexpr uint64 batch = 64; // steps per gcd
+
+    for (uint64 a = 1; a < 16; ++a)
+    {
+        auto f = [a, c](uint64 x)
+        {
+            return static_cast<uint64>((uint128(x) * x + a) % c);
+        };
+        uint64 x = 2;
+        uint64 y = 2;
+        uint64 saved = 2;
+        uint64 prod = 1;
+        uint64 g = 1;
+        for (uint64 r = 1; g == 1; r *= 2)
+        {
+            x = y;
+            for (uint64 q = 0; q < r; ++q)
+            {
+                y = f(y);
+            }
+            for (uint64 k = 0; k < r && g == 1; k += batch)
+            {
+                saved = y;
+                for (uint64 q = 0; q < std::min(batch, r - k); ++q)
+                {
+                    y = f(y);
+                    prod = uint128(prod) * (x < y ? y - x : x - y) % c;
+                }
+                g = std::gcd(prod, c);
+            }
+        }
+        // The batch overshot, step through it again one gcd at a time
+        if (g == c)
+        {
+            do
+            {
+                saved = f(saved);
+                g = std::gcd(x < saved ? saved - x : x - saved, c);
+            } while (g == 1);
+        }
+        if (g != c)
+        {
+            return g;
+        }
     }
+    return 0;
+}
 
-    return factors;
+// Partial relations as edges of a graph on the large primes and 1, a
+//     relation with one large prime L is the edge (1, L). The edges of a
+//     cycle multiply out to a full relation: every large prime of it is
+//     squared, and the matrix only sees the primes of the base.
+// Union-find finds the cycles, the edges that do not close one form a
+//     spanning forest whose paths give the rest of the cycle.
+class PartialRelations
+{
+    std::unordered_map<int64, int32> vertices;
+    std::vector<int32> parent;
+    // Forest edges of every vertex: (neighbour, index in 'edges')
+    Matrix<std::pair<int32, int32>> forest;
+    std::vector<SmoothNumber> edges;
+
+    int32 vertex(int64 prime)
+    {
+        auto [it, inserted] = vertices.try_emplace(prime, parent.size());
+        if (inserted)
+        {
+            parent.push_back(it->second);
+            forest.emplace_back();
+        }
+        return it->second;
+    }
+
+    int32 find(int32 v)
+    {
+        while (parent[v] != v)
+        {
+            parent[v] = parent[parent[v]];
+            v = parent[v];
+        }
+        return v;
+    }
+
+    // Indices of the forest edges on the path from u to v
+    std::vector<int32> path(int32 u, int32 v) const
+    {
+        // Breadth-first from u, the edge each vertex was reached by
+        std::unordered_map<int32, std::pair<int32, int32>> reached;
+        reached[u] = {u, -1};
+        std::vector<int32> queue{u};
+        for (usize q = 0; q < queue.size() && !reached.count(v); ++q)
+        {
+            for (auto [next, edge] : forest[queue[q]])
+            {
+                if (reached.try_emplace(next, queue[q], edge).second)
+                {
+                    queue.push_back(next);
+                }
+            }
+        }
+
+        std::vector<int32> result;
+        for (int32 w = v; w != u; w = reached[w].first)
+        {
+            result.push_back(reached[w].second);
+        }
+        return result;
+    }
+
+    public:
+        // Adds a partial relation. If it closes a cycle, returns true and
+        //     the full relation of the cycle in 'full'.
+        bool add(PartialRelation&& partial, const intxx& n, SmoothNumber& full)
+        {
+            const int32 u = vertex(partial.large1);
+            const int32 v = vertex(partial.large2);
+            const int32 root_u = find(u);
+            const int32 root_v = find(v);
+            if (root_u != root_v)
+            {
+                parent[root_u] = root_v;
+                forest[u].emplace_back(v, edges.size());
+                forest[v].emplace_back(u, edges.size());
+                edges.push_back(std::move(partial.relation));
+                return false;
+            }
+
+            auto& [Y, Q_x, factors] = full;
+            std::tie(Y, Q_x, factors) = std::move(partial.relation);
+            for (int32 edge : path(u, v))
+            {
+                const auto& [Y_e, Q_e, factors_e] = edges[edge];
+                Y = Y * Y_e % n;
+                Q_x *= Q_e;
+                for (const auto& [p, e] : factors_e)
+                {
+                    if (p == -1)
+                    {
+                        factors[-1] = (factors[-1] + e) % 2;
+                    }
+                    else
+                    {
+                        factors[p] += e;
+                    }
+                }
+            }
+            if (factors.count(-1) && factors[-1] == 0)
+            {
+                factors.erase(-1);
+            }
+            return true;
+        }
+
+        // Number of partial relations kept
+        usize size() const
+        {
+            return edges.size();
+        }
+};
+
+// The sieve array is processed in blocks of this size, so the block
+//     stays in the L1 cache while all primes are added to it
+static constexpr int32 SIEVE_BLOCK_BYTES = 1 << 15;
+
+// Primes below this are not sieved, they hit almost every entry and add
+//     little. Their expected share lowers the threshold instead.
+static constexpr int32 SIEVE_TINY_PRIME = 32;
+
+// The scan compares this many entries against one threshold
+static constexpr int32 SCAN_PIECE = 64;
+
+// min |g(x)| for x from [lo, hi] with g(x) = ax^2 + bx + c in floating
+//     point. Only used for thresholds, so the rounding does not matter.
+static float64 min_abs_quadratic(
+    float64 a, float64 b, float64 c, float64 lo, float64 hi
+)
+{
+    auto g = [a, b, c](float64 x) { return (a * x + b) * x + c; };
+    const float64 g_lo = g(lo);
+    const float64 g_hi = g(hi);
+    if ((g_lo <= 0) != (g_hi <= 0))
+    {
+        return 0;
+    }
+    float64 low = std::min(std::abs(g_lo), std::abs(g_hi));
+    const float64 vertex = -b / (2 * a);
+    if (lo < vertex && vertex < hi)
+    {
+        low = std::min(low, std::abs(g(vertex)));
+    }
+    return low;
 }
 
-static std::vector<SmoothNumber> find_smooth_numbers(
-    intxx n, int32 B, int32 M, int32 procs, const FactorBase& factor_base,
-    bool verbose
+// Bit q of the result is set if target <= block[q], q < SCAN_PIECE
+template<typename Log>
+static uint64 scan_piece(const Log* block, Log target)
+{
+    uint64 mask = 0;
+    for (int32 q = 0; q < SCAN_PIECE; ++q)
+    {
+        mask |= uint64(target <= block[q]) << q;
+    }
+    return mask;
+}
+
+#if defined(__x86_64__)
+#define QS_SIMD 1
+#include <immintrin.h>
+#endif
+
+#if QS_SIMD
+
+// a >= t <=> max(a, t) = a, there is no unsigned byte compare
+static uint64 scan_piece_sse2(const uint8* block, uint8 target)
+{
+    const __m128i t = _mm_set1_epi8(target);
+    uint64 mask = 0;
+    for (int32 q = 0; q < SCAN_PIECE; q += 16)
+    {
+        const __m128i v = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(block + q)
+        );
+        const __m128i ge = _mm_cmpeq_epi8(_mm_max_epu8(v, t), v);
+        mask |= uint64(uint16(_mm_movemask_epi8(ge))) << q;
+    }
+    return mask;
+}
+
+__attribute__((target("avx2")))
+static uint64 scan_piece_avx2(const uint8* block, uint8 target)
+{
+    const __m256i t = _mm256_set1_epi8(target);
+    uint64 mask = 0;
+    for (int32 q = 0; q < SCAN_PIECE; q += 32)
+    {
+        const __m256i v = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(block + q)
+        );
+        const __m256i ge = _mm256_cmpeq_epi8(_mm256_max_epu8(v, t), v);
+        mask |= uint64(uint32(_mm256_movemask_epi8(ge))) << q;
+    }
+    return mask;
+}
+
+// The byte scan is the one QS uses, it gets the vector versions
+template<>
+uint64 scan_piece<uint8>(const uint8* block, uint8 target)
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2)
+    {
+        return scan_piece_avx2(block, target);
+    }
+    return scan_piece_sse2(block, target);
+}
+
+#endif // QS_SIMD
+
+// Relations wanted beyond the size of the factor base
+static constexpr int32 RELATION_SURPLUS = 32;
+
+// Large primes of partial relations are below this many times B
+static constexpr int32 LARGE_PRIME_FACTOR = 64;
+
+// The sieve lets through values whose unsieved part has up to this many
+//     times the bits of the large bound. Above 1 more double large prime
+//     relations pass, but the time spent on false candidates outgrows
+//     the cycles they bring for the sizes QS is used for.
+static constexpr float64 LARGE_PRIME_SLACK = 1.0;
+
+// Families of polynomials tried at most, in case relations never come
+static constexpr int32 MAX_FAMILIES = 1 << 16;
+
+// A below this is not worth the switching, a single polynomial is used
+static constexpr float64 SIQS_MIN_A = 2000;
+
+// Typical size of the primes A is built from
+static constexpr float64 SIQS_PRIME_SIZE = 2000;
+
+// splitmix64 finalizer, makes the seeds of the families independent
+static uint64 mix_seed(uint64 x)
+{
+    x += 0x9e3779b97f4a7c15;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+// Natural logarithm of a positive n of any size
+static float64 log_intxx(const intxx& n)
+{
+    long exp;
+    const float64 d = mpz_get_d_2exp(&exp, n.get_mpz_t());
+    return std::log(d) + exp * std::log(2.0);
+}
+
+// A family of self-initialising polynomials
+//     g(x) = ((Ax + b)^2 - n) / A = Ax^2 + 2bx + c
+// A is a product of s primes q_l of the factor base, b runs over the
+//     2^(s - 1) values B_1 +- B_2 ... +- B_s with b^2 = n (mod A) in
+//     Gray code order, so the next b and the roots of every prime
+//     differ from the previous ones by one precomputed increment.
+// Without primes the family is the single polynomial of the plain
+//     sieve, A = 1 and b = sqrt(n).
+class SiqsFamily
+{
+    const FactorBase& factor_base;
+    std::vector<usize> A_primes;
+    std::vector<intxx> Bs;
+    // 2 B_l / A mod p, for l and for every prime of the factor base
+    Matrix<uint32> increments;
+    std::vector<SieveRoots> roots_;
+    int32 poly;
+
+    public:
+        intxx A;
+        intxx b;
+        intxx c;
+
+        // A_primes -- indices of the q_l in the factor base
+        // sqrts -- find_sqrt_n_mod_p
+        SiqsFamily(
+            const intxx& n,
+            int32 M,
+            const FactorBase& factor_base,
+            const std::vector<uint32>& sqrts,
+            std::vector<usize> A_primes
+        )
+            : factor_base(factor_base)
+            , A_primes(std::move(A_primes))
+            , increments(this->A_primes.size())
+            , roots_(factor_base.size())
+            , poly(0)
+            , A(1)
+            , b(0)
+        {
+            if (this->A_primes.empty())
+            {
+                b = sqrt_intxx(n);
+            }
+            for (usize l : this->A_primes)
+            {
+                A *= factor_base[l];
+            }
+            // B_l = A / q_l * gamma, gamma = t (A / q_l)^(-1) mod q_l, so
+            //     B_l^2 = n (mod q_l) and B_l = 0 (mod the other q)
+            for (usize l : this->A_primes)
+            {
+                const uint32 q = factor_base[l];
+                const intxx A_q = A / q;
+                uint32 gamma = uint64(sqrts[l])
+                             * inv_mod(mod_ui(A_q, q), q) % q;
+                if (q / 2 < gamma)
+                {
+                    gamma = q - gamma;
+                }
+                Bs.push_back(A_q * gamma);
+                b += Bs.back();
+            }
+            c = (b * b - n) / A;
+
+            for (std::vector<uint32>& inc : increments)
+            {
+                inc.resize(factor_base.size());
+            }
+            for (usize q = 0; q < factor_base.size(); ++q)
+            {
+                const uint32 p = factor_base[q];
+                const bool divides_A = std::find(
+                    this->A_primes.begin(),
+                    this->A_primes.end(),
+                    q
+                ) != this->A_primes.end();
+                if (divides_A)
+                {
+                    roots_[q] = SieveRoots{-1, -1};
+                    continue;
+                }
+
+                // x = (+-t - b) / A (mod p), shifted by M into the array
+                const uint64 A_inv = inv_mod(mod_ui(A, p), p);
+                const uint64 t = sqrts[q];
+                const uint64 b_p = mod_ui(b, p);
+                const uint64 M_p = M % p;
+                const int32 start1 =
+                        (A_inv * ((t + p - b_p) % p) + M_p) % p;
+                const int32 start2 =
+                        (A_inv * ((2 * p - t - b_p) % p) + M_p) % p;
+                roots_[q] = SieveRoots{
+                    start1,
+                    start1 == start2 ? -1 : start2
+                };
+                for (usize l = 0; l < Bs.size(); ++l)
+                {
+                    increments[l][q] = 2 * mod_ui(Bs[l], p) * A_inv % p;
+                }
+            }
+        }
+
+        // Number of polynomials of the family
+        int32 count() const
+        {
+            return A_primes.empty() ? 1 : 1 << (A_primes.size() - 1);
+        }
+
+        const std::vector<usize>& primes() const
+        {
+            return A_primes;
+        }
+
+        const std::vector<SieveRoots>& roots() const
+        {
+            return roots_;
+        }
+
+        // Switches to the next polynomial, false if there is none.
+        //     Polynomial i differs from i - 1 in the sign of B_(v + 1),
+        //     2^v || i, and the roots move by the same increment.
+        bool next(const intxx& n)
+        {
+            if (count() <= poly + 1)
+            {
+                return false;
+            }
+            const int32 i = ++poly;
+            const int32 v = __builtin_ctz(i);
+            const bool minus = (((i >> v) + 1) / 2) % 2 == 1;
+
+            if (minus)
+            {
+                b -= 2 * Bs[v];
+            }
+            else
+            {
+                b += 2 * Bs[v];
+            }
+            c = (b * b - n) / A;
+
+            // x = (+-t - b) / A, so the roots move opposite to b
+            for (usize q = 0; q < factor_base.size(); ++q)
+            {
+                const uint32 p = factor_base[q];
+                const uint32 inc = minus
+                            ? increments[v][q]
+                            : (p - increments[v][q]) % p;
+                for (int32* start : {&roots_[q].start1, &roots_[q].start2})
+                {
+                    if (0 <= *start)
+                    {
+                        *start = (uint32(*start) + inc) % p;
+                    }
+                }
+            }
+            return true;
+        }
+};
+
+// Indices of the primes of A for family k, A is about e^log_target.
+//     s - 1 primes are drawn from the window [lo, hi) of the factor base,
+//     the last one is the prime that brings A closest to the target.
+static std::vector<usize> choose_A_primes(
+    const FactorBase& factor_base,
+    usize lo,
+    usize hi,
+    int32 s,
+    float64 log_target,
+    uint64 k
 )
 {
-    intxx sqrt_n = sqrt_intxx(n);
-    std::vector<float64> sieve_array(2 * M + 1, 0.0);
+    std::vector<usize> chosen;
+    auto taken = [&chosen](usize q)
+    {
+        return std::find(chosen.begin(), chosen.end(), q) != chosen.end();
+    };
 
-    if (procs) {} // DEV [fake]
+    uint64 state = mix_seed(k);
+    float64 log_rest = log_target;
+    while (static_cast<int32>(chosen.size()) + 1 < s)
+    {
+        state = mix_seed(state);
+        const usize q = lo + state % (hi - lo);
+        if (!taken(q))
+        {
+            chosen.push_back(q);
+            log_rest -= std::log(factor_base[q]);
+        }
+    }
+    if (s == 1)
+    {
+        chosen.push_back(lo + mix_seed(state) % (hi - lo));
+        return chosen;
+    }
 
-    if (verbose)
+    // Nearest free prime of the factor base past the tiny ones
+    const usize first = std::lower_bound(
+        factor_base.begin(),
+        factor_base.end(),
+        SIEVE_TINY_PRIME
+    ) - factor_base.begin();
+    const float64 rest = std::exp(log_rest);
+    usize best = factor_base.size();
+    for (usize q = first; q < factor_base.size(); ++q)
     {
-        std::cout << "Searching roots..." << std::endl;
+        if (taken(q))
+        {
+            continue;
+        }
+        if (best == factor_base.size()
+            || std::abs(factor_base[q] - rest)
+               < std::abs(factor_base[best] - rest))
+        {
+            best = q;
+        }
+        if (rest < factor_base[q])
+        {
+            break;
+        }
     }
-    auto range = std::views::iota(
-        static_cast<usize>(0),
-        factor_base.size()
+    chosen.push_back(best);
+    return chosen;
+}
+
+// What every polynomial of a run shares, see find_smooth_numbers
+// Log -- type of a sieve entry. An entry sums the logarithms of the
+//     primes that divide g(x), rounded to 1 / (2^bits(Log) / 256) of a
+//     bit, so uint8 holds whole bits and wider types add precision
+template<typename Log>
+struct SieveSetup
+{
+    static constexpr int32 block_size = SIEVE_BLOCK_BYTES / sizeof(Log);
+    static constexpr float64 scale =
+                (std::numeric_limits<Log>::max() + 1.0) / 256;
+
+    const intxx& n;
+    int32 M;
+    const FactorBase& factor_base;
+    std::vector<Log> logs;
+    // Primes [first, medium) hit a block many times and are sieved
+    //     block by block, primes from 'medium' on hit it at most once
+    //     and go through the buckets
+    usize first;
+    usize medium;
+    // How far below log2 |g(x)| a candidate may be, scaled
+    float64 slack;
+    // Large primes of partial relations are below this, it is below the
+    //     square of the largest prime of the base, so a cofactor below
+    //     it is a prime. It is below 2^31 too, a large prime is a key of
+    //     Factors like the primes of the base.
+    int64 large_bound;
+};
+
+// One hit of a large prime: the offset in its block in the high half and
+//     the scaled logarithm in the low half
+using BucketEntry = uint32;
+
+// Memory of one sieve worker, reused for all its polynomials
+template<typename Log>
+struct SieveBuffers
+{
+    static_assert(
+        SieveSetup<Log>::block_size <= (1 << 16) && sizeof(Log) <= 2,
+        "a bucket entry holds a 16-bit offset and a 16-bit logarithm"
     );
-    std::for_each(
-        std::execution::par,
-        range.begin(),
-        range.end(),
-        [
-            &factor_base = std::as_const(factor_base),
-            &n           = std::as_const(n),
-            &sqrt_n      = std::as_const(sqrt_n),
-            &sieve_array = sieve_array,
-            M            = M
-        ](usize q)
-        {
-            int32 p = factor_base[q];
-            float64 log_p = std::log(p);
-            auto roots = find_Qx_roots(n, sqrt_n, p);
-            for (const auto& root : roots)
+
+    // Entries past the end of the array stay zero, the scan reads whole
+    //     pieces
+    std::vector<Log> block;
+    std::vector<Log> targets;
+    // Next index each prime below 'medium' divides, carried from block
+    //     to block
+    std::vector<SieveRoots> roots;
+    // The hits of the large primes sorted by block before the sieve
+    //     starts, so that the array is never touched out of the block in
+    //     the cache. Cleared but not freed between polynomials.
+    std::vector<std::vector<BucketEntry>> buckets;
+    intxx Y;
+    intxx Q_x;
+    intxx g_x;
+    intxx cofactor;
+
+    explicit SieveBuffers(const SieveSetup<Log>& setup)
+        : block(SieveSetup<Log>::block_size)
+        , targets(SieveSetup<Log>::block_size / SCAN_PIECE)
+        , roots(setup.medium)
+        , buckets(
+            (2 * setup.M + SieveSetup<Log>::block_size)
+            / SieveSetup<Log>::block_size
+        )
+    {}
+};
+
+// Sieves x from [-M, M] for the current polynomial of the family in
+//     blocks and calls report(relation, large1, large2) for every g(x)
+//     that is smooth but for at most two primes below the large bound,
+//     a missing large prime is 1. Stops as soon as report returns false.
+template<typename Log, typename Report>
+static void sieve_polynomial(
+    const SieveSetup<Log>& setup,
+    const SiqsFamily& family,
+    SieveBuffers<Log>& buf,
+    Report report
+)
+{
+    constexpr int32 block_size = SieveSetup<Log>::block_size;
+    constexpr float64 scale = SieveSetup<Log>::scale;
+    const FactorBase& factor_base = setup.factor_base;
+    const int32 M = setup.M;
+    const int32 size = 2 * M + 1;
+    const std::vector<SieveRoots>& poly_roots = family.roots();
+    const float64 a = family.A.get_d();
+    const float64 b = 2 * family.b.get_d();
+    const float64 c = family.c.get_d();
+
+    std::copy(
+        poly_roots.begin() + setup.first,
+        poly_roots.begin() + setup.medium,
+        buf.roots.begin() + setup.first
+    );
+    for (std::vector<BucketEntry>& bucket : buf.buckets)
+    {
+        bucket.clear();
+    }
+    for (usize q = setup.medium; q < factor_base.size(); ++q)
+    {
+        const int32 p = factor_base[q];
+        for (int32 start : {poly_roots[q].start1, poly_roots[q].start2})
+        {
+            if (start < 0)
+            {
+                continue;
+            }
+            for (int32 idx = start; idx < size; idx += p)
+            {
+                buf.buckets[idx / block_size].push_back(
+                    BucketEntry(idx % block_size) << 16 | setup.logs[q]
+                );
+            }
+        }
+    }
+
+    for (int32 lo = 0; lo < size; lo += block_size)
+    {
+        const int32 len = std::min(block_size, size - lo);
+        const int32 hi = lo + len;
+
+        std::fill(buf.block.begin(), buf.block.end(), 0);
+        for (usize q = setup.first; q < setup.medium; ++q)
+        {
+            const int32 p = factor_base[q];
+            const Log log_p = setup.logs[q];
+            for (int32* start : {&buf.roots[q].start1, &buf.roots[q].start2})
             {
-                intxx start_ = (M + root) % p;
-                int32 start = start_.get_si();
-                for (int32 q = start; q < 2 * M + 1; q += p)
+                if (*start < 0)
                 {
-                    sieve_array[q] += log_p;
+                    continue;
+                }
+                int32 idx = *start;
+                for (; idx < hi; idx += p)
+                {
+                    buf.block[idx - lo] += log_p;
                 }
+                *start = idx;
             }
         }
-    );
+        for (BucketEntry entry : buf.buckets[lo / block_size])
+        {
+            buf.block[entry >> 16] += Log(entry);
+        }
+
+        // Thresholds first: log2 min |g(x)| of each piece, less slack
+        for (int32 piece = 0; piece * SCAN_PIECE < len; ++piece)
+        {
+            const int32 x_lo = lo + piece * SCAN_PIECE - M;
+            const int32 x_hi = std::min(x_lo + SCAN_PIECE, hi - M) - 1;
+            const float64 low = min_abs_quadratic(a, b, c, x_lo, x_hi);
+            const float64 target = low < 1
+                        ? 0
+                        : std::log2(low) * scale - setup.slack;
+            buf.targets[piece] = std::clamp<float64>(
+                std::ceil(target),
+                0,
+                std::numeric_limits<Log>::max()
+            );
+        }
+
+        // Only candidates get their Y = Ax + b, Q(x) = Y^2 - n and
+        //     g(x) = Q(x) / A in multiprecision
+        for (int32 piece = 0; piece * SCAN_PIECE < len; ++piece)
+        {
+            uint64 mask = scan_piece<Log>(
+                buf.block.data() + piece * SCAN_PIECE,
+                buf.targets[piece]
+            );
+            while (mask)
+            {
+                const int32 idx = lo + piece * SCAN_PIECE
+                                     + __builtin_ctzll(mask);
+                mask &= mask - 1;
+                if (hi <= idx)
+                {
+                    break;
+                }
+
+                buf.Y = family.A * (idx - M) + family.b;
+                buf.Q_x = buf.Y * buf.Y - setup.n;
+                if (buf.Q_x == 0)
+                {
+                    continue;
+                }
+                mpz_divexact(
+                    buf.g_x.get_mpz_t(),
+                    buf.Q_x.get_mpz_t(),
+                    family.A.get_mpz_t()
+                );
+                auto factors = factor_over_base(
+                    buf.g_x,
+                    idx,
+                    factor_base,
+                    poly_roots,
+                    buf.cofactor
+                );
+
+                // A cofactor below the large bound is a prime, one below
+                //     its square may split into two
+                const int64 bound = setup.large_bound;
+                int64 large1 = 1;
+                int64 large2 = 1;
+                if (buf.cofactor < bound)
+                {
+                    large1 = buf.cofactor.get_si();
+                }
+                else if (buf.cofactor < intxx(bound) * bound)
+                {
+                    constexpr int reps_count = 10;
+                    if (mpz_probab_prime_p(
+                        buf.cofactor.get_mpz_t(),
+                        reps_count
+                    ))
+                    {
+                        continue;
+                    }
+                    const uint64 c = mpz_get_ui(buf.cofactor.get_mpz_t());
+                    const uint64 d = pollard_rho(c);
+                    if (d == 0 || bound <= int64(d) || bound <= int64(c / d))
+                    {
+                        continue;
+                    }
+                    large1 = std::min(d, c / d);
+                    large2 = std::max(d, c / d);
+                }
+                else
+                {
+                    continue;
+                }
+
+                for (usize l : family.primes())
+                {
+                    ++factors[factor_base[l]];
+                }
+                for (int64 large : {large1, large2})
+                {
+                    if (large != 1)
+                    {
+                        ++factors[static_cast<int32>(large)];
+                    }
+                }
+                if (large1 == large2)
+                {
+                    large1 = large2 = 1; // the square of a large prime
+                }
+                if (!report(
+                    SmoothNumber{buf.Y, buf.Q_x, std::move(factors)},
+                    large1,
+                    large2
+                ))
+                {
+                    return;
+                }
+            }
+        }
+    }
+}
+
+// Finds relations Y^2 = Q (mod n) with Q smooth over the factor base,
+//     Y = Ax + b for x from [-M, M] and the polynomials of SIQS, until
+//     there are RELATION_SURPLUS more of them than primes in the base
+// Log -- type of a sieve entry, see SieveSetup
+template<typename Log>
+static std::vector<SmoothNumber> find_smooth_numbers(
+    intxx n, int32 B, int32 M, int32 procs, const FactorBase& factor_base,
+    bool verbose
+)
+{
+    const int32 wanted = factor_base.size() + RELATION_SURPLUS;
 
-    float64 threshold = std::log(B) * 1.5;
-    std::vector<SmoothNumber> smooth_numbers;
     if (verbose)
     {
-        std::cout << "Seive..." << std::endl;
+        std::cout << "Searching roots..." << std::endl;
     }
-    for (int32 x = -M; x < M + 1; ++x)
+    const std::vector<uint32> sqrts =
+                find_sqrt_n_mod_p(n, procs, factor_base);
+
+    SieveSetup<Log> setup{n, M, factor_base, {}, 0, 0, 0, 0};
+    float64 tiny_share = 0;
+    while (setup.first < factor_base.size()
+           && factor_base[setup.first] < SIEVE_TINY_PRIME)
     {
-        constexpr int M_factor = 10;
-        if (verbose && ((x + M) % (M / M_factor) == 0))
+        const int32 p = factor_base[setup.first];
+        tiny_share += (p == 2 ? 1 : 2) * std::log2(p) / (p - 1);
+        ++setup.first;
+    }
+    setup.medium = setup.first;
+    while (setup.medium < factor_base.size()
+           && factor_base[setup.medium] < setup.block_size)
+    {
+        ++setup.medium;
+    }
+    setup.logs.resize(factor_base.size());
+    for (usize q = 0; q < factor_base.size(); ++q)
+    {
+        setup.logs[q] = std::lround(std::log2(factor_base[q]) * setup.scale);
+    }
+    setup.large_bound = std::min<int64>({
+        int64(B) * LARGE_PRIME_FACTOR,
+        int64(factor_base.back()) * factor_base.back() - 1,
+        std::numeric_limits<int32>::max()
+    });
+    setup.slack = (
+        std::max(
+            1.5 * std::log2(B),
+            LARGE_PRIME_SLACK * std::log2(setup.large_bound)
+        )
+        + tiny_share
+    ) * setup.scale;
+
+    // A of about sqrt(2n) / M keeps |g(x)| below M sqrt(n / 2). Its
+    //     primes come from a window around the s-th root of the target.
+    const float64 log_target = 0.5 * log_intxx(2 * n) - std::log(M);
+    int32 s = 0;
+    usize window_lo = 0;
+    usize window_hi = 0;
+    if (std::log(SIQS_MIN_A) < log_target)
+    {
+        s = std::max<int32>(
+            1,
+            std::lround(log_target / std::log(SIQS_PRIME_SIZE))
+        );
+        while (2 * std::exp(log_target / s) > factor_base.back())
+        {
+            ++s;
+        }
+        const float64 q_size = std::exp(log_target / s);
+        window_lo = std::lower_bound(
+            factor_base.begin(),
+            factor_base.end(),
+            std::max<float64>(q_size / 2, SIEVE_TINY_PRIME)
+        ) - factor_base.begin();
+        window_hi = std::lower_bound(
+            factor_base.begin(),
+            factor_base.end(),
+            2 * q_size
+        ) - factor_base.begin();
+        if (window_hi < window_lo + s + 2)
         {
-            std::cout << "  " << 100 * (x + M) / (2 * M) << "%"
-                      << std::endl;
+            s = 0;
         }
-        int32 idx = x + M;
-        intxx Q_x = (x + sqrt_n) * (x + sqrt_n) - n;
+    }
+    const int32 family_count = s == 0 ? 1 : MAX_FAMILIES;
 
-        if (Q_x == 0)
+    if (verbose)
+    {
+        std::cout << "Seive [s = " << s << "]..." << std::endl;
+    }
+
+    // Families are handed out one at a time, a worker sieves and scans
+    //     all polynomials of its family alone, so nothing but the
+    //     counters, the queues and the graph is shared
+    std::atomic<int32> next_family = 0;
+    std::atomic<int32> found = 0;
+    RelationQueue<SmoothNumber> relations;
+    RelationQueue<PartialRelation> partials;
+    // A single polynomial for a small n gives far more relations than
+    //     wanted, the surplus would only slow down the elimination
+    auto add_full = [&](SmoothNumber&& relation)
+    {
+        const int32 done = ++found;
+        if (wanted < done)
         {
-            continue;
+            return;
         }
-        float64 val = std::abs(
-            sieve_array[idx] - std::log(std::abs(Q_x.get_d()))
-        );
+        relations.push(std::move(relation));
+
+        constexpr int M_factor = 10;
+        const int32 decile = M_factor * done / wanted;
+        if (verbose && M_factor * (done - 1) / wanted < decile)
+        {
+            std::cout << ("  " + std::to_string(100 * decile / M_factor)
+                          + "%\n") << std::flush;
+        }
+    };
+    auto report = [&](SmoothNumber&& relation, int64 large1, int64 large2)
+    {
+        if (large1 == 1 && large2 == 1)
+        {
+            add_full(std::move(relation));
+        }
+        else
+        {
+            partials.push({std::move(relation), large1, large2});
+        }
+        return found < wanted;
+    };
+
+    // Whoever finds the graph free after a polynomial moves the partial
+    //     relations into it, the others go on sieving
+    std::mutex graph_mutex;
+    PartialRelations graph;
+    auto merge_partials = [&]()
+    {
+        SmoothNumber full;
+        for (PartialRelation& partial : partials.take_all())
+        {
+            if (graph.add(std::move(partial), n, full))
+            {
+                add_full(std::move(full));
+            }
+        }
+    };
 
-        if (val < threshold)
+    // Families are drawn at random, one A is sieved only once
+    std::mutex used_mutex;
+    std::set<std::vector<usize>> used_A;
+    auto worker = [&](int32)
+    {
+        SieveBuffers<Log> buf(setup);
+        for (
+            int32 k = next_family++;
+            k < family_count && found < wanted;
+            k = next_family++
+        )
         {
-            auto factors = factor_over_base(Q_x, factor_base);
-            if (factors.size())
+            std::vector<usize> A_primes;
+            if (s != 0)
             {
-                smooth_numbers.emplace_back(
-                    x,
-                    std::move(Q_x),
-                    std::move(factors)
+                A_primes = choose_A_primes(
+                    factor_base,
+                    window_lo,
+                    window_hi,
+                    s,
+                    log_target,
+                    k
                 );
+                std::sort(A_primes.begin(), A_primes.end());
+                std::lock_guard lock(used_mutex);
+                if (!used_A.insert(A_primes).second)
+                {
+                    continue;
+                }
             }
+            SiqsFamily family(n, M, factor_base, sqrts, std::move(A_primes));
+            do
+            {
+                sieve_polynomial(setup, family, buf, report);
+                std::unique_lock lock(graph_mutex, std::try_to_lock);
+                if (lock.owns_lock())
+                {
+                    merge_partials();
+                }
+            } while (found < wanted && family.next(n));
         }
+    };
+    run_workers(std::max(1, procs), worker);
+    merge_partials();
+    if (verbose)
+    {
+        std::cout << "Relations: " << std::min<int32>(found, wanted)
+                  << " full and combined, "
+                  << graph.size() << " partial kept" << std::endl;
     }
 
+    // In the order of Y whatever the threads did, a relation found twice
+    //     is kept once
+    std::vector<SmoothNumber> smooth_numbers = relations.take_all();
+    std::sort(
+        smooth_numbers.begin(),
+        smooth_numbers.end(),
+        [](const SmoothNumber& a, const SmoothNumber& b)
+        {
+            return std::get<0>(a) < std::get<0>(b);
+        }
+    );
+    smooth_numbers.erase(
+        std::unique(
+            smooth_numbers.begin(),
+            smooth_numbers.end(),
+            [](const SmoothNumber& a, const SmoothNumber& b)
+            {
+                return std::get<0>(a) == std::get<0>(b);
+            }
+        ),
+        smooth_numbers.end()
+    );
+
     return smooth_numbers;
 }
 
@@ -380,7 +1470,7 @@ static Matrix<int32> build_exponent_matrix(
 )
 {
     Matrix<int32> matrix;
-    for (const auto& [x, Qx, factors] : smooth_numbers)
+    for (const auto& [Y, Qx, factors] : smooth_numbers)
     {
         std::vector<int32> vec;
         if (factors.count(-1))
@@ -394,10 +1484,6 @@ static Matrix<int32> build_exponent_matrix(
 
         for (auto p : factor_base)
         {
-            if (p == 2)
-            {
-                continue;
-            }
             vec.push_back(
                 factors.count(p) ? factors.at(p) % 2 : 0
             );
@@ -415,8 +1501,6 @@ static intxx find_devider(
     const Matrix<int32>& dependencies
 )
 {
-    intxx sqrt_n = sqrt_intxx(n);
-
     for (const auto& dep_indices : dependencies)
     {
         intxx X = 1;
@@ -424,8 +1508,8 @@ static intxx find_devider(
 
         for (int32 idx : dep_indices)
         {
-            const auto& [x, Q_x, factors] = smooth_numbers[idx];
-            X = (X * (x + sqrt_n)) % n;
+            const auto& [Y, Q_x, factors] = smooth_numbers[idx];
+            X = (X * Y) % n;
 
             for (const auto& [key, value] : factors)
             {
@@ -433,10 +1517,6 @@ static intxx find_devider(
                 {
                     continue;
                 }
-                if (Y_factors.count(key))
-                {
-                    Y_factors[key] = 0;
-                }
                 Y_factors[key] += value;
             }
         }
@@ -445,7 +1525,7 @@ static intxx find_devider(
         for (const auto& [key, value] : Y_factors)
         {
             if (value % 2 != 0) {
-                all_even = true;
+                all_even = false;
                 break;
             }
         }
@@ -486,12 +1566,21 @@ std::vector<intxx> factor_QS_parm(
 )
 {
     error_code = FactorQsError::success;
+
+    // X = +-Y (mod p^2) for every congruence of squares, so a square
+    //     never splits
+    if (mpz_perfect_square_p(n.get_mpz_t()))
+    {
+        intxx r = sqrt_intxx(n);
+        return {r, r};
+    }
+
     if (verbose)
     {
         std::cout << "Bulding factor base [B = "
                   << B << "]..." << std::endl;
     }
-    FactorBase factor_base = find_factor_base(n, B);
+    FactorBase factor_base = find_factor_base(n, B, procs);
     if (verbose)
     {
         std::cout << "Factor base size: "
@@ -505,7 +1594,9 @@ std::vector<intxx> factor_QS_parm(
                   << "]..." << std::endl;
     }
     std::vector<SmoothNumber> smooth_numbers =
-                find_smooth_numbers(n, B, M, procs, factor_base, verbose);
+                find_smooth_numbers<SieveLog>(
+                    n, B, M, procs, factor_base, verbose
+                );
     if (verbose)
     {
         std::cout << "Found " << smooth_numbers.size()
@@ -567,10 +1658,34 @@ std::vector<intxx> factor_QS_parm(
     return ret;
 }
 
+// Smoothness bound B and half interval M by the size of n, the first
+//     row with at least the bits of n is used
+static constexpr struct
+{
+    int32 bits;
+    int32 B;
+    int32 M;
+} QS_PARAMETERS[] = {
+    { 40,   1000,   5000},
+    { 64,   2000,  16384},
+    {100,   6000,  32768},
+    {133,  20000,  32768},
+    {166,  50000,  65536},
+    {200, 100000,  65536},
+    {233, 200000,  98304},
+    {  0, 300000, 131072},
+};
+
 std::vector<intxx> factor_QS_mt(const intxx &n, int32 procs)
 {
-    int32 B = 1000;
-    int32 M = 5000;
+    const int32 bits = mpz_sizeinbase(n.get_mpz_t(), 2);
+    usize row = 0;
+    while (QS_PARAMETERS[row].bits != 0 && QS_PARAMETERS[row].bits < bits)
+    {
+        ++row;
+    }
+    int32 B = QS_PARAMETERS[row].B;
+    int32 M = QS_PARAMETERS[row].M;
     bool verbose = false;
     FactorQsError error_code;
     for (int q = 0; q < 6; ++q) {
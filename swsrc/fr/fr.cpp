@@ -5,6 +5,8 @@
 #include <iomanip>
 #include <csignal>
 #include <cmath>
+#include <algorithm>
+#include <vector>
 
 namespace statistics
 {
@@ -25,7 +27,7 @@ namespace statistics
             return;
 
         double m = sum / count;
-        double d = std::sqrt(square_sum / count - m*m);
+        double d = std::sqrt(std::max(square_sum / count - m*m, 0.0));
         std::cout << "Mean:      " << m << " ms" << std::endl;
         std::cout << "Deviation: " << d << " ms" << std::endl;
     }
@@ -45,6 +47,7 @@ int main(int argc, char **argv)
     usize output_width      = 25;
     bool verify             = false;
     bool show_time          = false;
+    usize batch_size        = 1;
     std::string com_port    = "/dev/ttyUSB0";
     FractorBase *fractor    = nullptr;
     uint32 baud_rate        = 115200;
@@ -90,6 +93,23 @@ int main(int argc, char **argv)
                 "n,nproc",
                 "set number of software computing processes",
                 cxxopts::value<int32>()->default_value("1")
+            )
+            (
+                "e,ecm-params",
+                "set file with ECM parameters: lines of \"bits B B2 C\"",
+                cxxopts::value<std::string>()
+            )
+            (
+                "c,checkpoint",
+                "set file to save ECM progress to and resume it from",
+                cxxopts::value<std::string>()
+            )
+            (
+                "batch",
+                "set count of numbers factored together (ecm only)",
+                cxxopts::value<usize>()->default_value(
+                    std::to_string(batch_size)
+                )
             );
 
         cxxopts::ParseResult flags = options.parse(argc, argv);
@@ -106,6 +126,9 @@ int main(int argc, char **argv)
         verify      = flags.count("verify");
         show_time   = flags.count("time");
 
+        if(flags.count("batch"))
+            batch_size = std::max<usize>(flags["batch"].as<usize>(), 1);
+
         if(flags.count("port"))
             com_port = flags["port"].as<std::string>();
 
@@ -121,7 +144,14 @@ int main(int argc, char **argv)
             }
             else if(mode_str == "ecm")
             {
-                fractor = new ECMFractor();
+                ECMFractor *ecm_fractor = new ECMFractor();
+                if(flags.count("checkpoint"))
+                {
+                    ecm_fractor->set_checkpoint(
+                        flags["checkpoint"].as<std::string>()
+                    );
+                }
+                fractor = ecm_fractor;
             }
             else if(mode_str == "hw")
             {
@@ -144,7 +174,25 @@ int main(int argc, char **argv)
         }
 
         if(flags.count("nproc"))
-            fractor->set_nproc(flags["nproc"].as<int32>());
+        {
+            int32 nproc = flags["nproc"].as<int32>();
+            if(nproc < 1)
+            {
+                std::cerr << "Incorrect nproc option" << std::endl;
+                return 1;
+            }
+            fractor->set_nproc(nproc);
+        }
+
+        if(flags.count("ecm-params"))
+        {
+            std::string path = flags["ecm-params"].as<std::string>();
+            if(!load_ecm_params(path))
+            {
+                std::cerr << "Incorrect ECM parameters file" << std::endl;
+                return 1;
+            }
+        }
     }
     catch(const cxxopts::exceptions::exception& e)
     {
@@ -161,64 +209,99 @@ int main(int argc, char **argv)
     uint32 size         = 0;
     uint32 factor_size  = 0;
 
+    std::vector<intxx> semiprimes;
+    std::vector<uint32> sizes;
+    std::vector<intxx> firsts;
+    std::vector<intxx> seconds;
+    std::vector<intxx> lefts;
+    std::vector<intxx> rights;
+    std::vector<bool> successes;
+
     std::cout << std::right;
     while(std::cin.peek() != EOF)
     {
-        raw_read(semiprime, size);
+        semiprimes.clear();
+        sizes.clear();
+        firsts.clear();
+        seconds.clear();
+        while(semiprimes.size() < batch_size && std::cin.peek() != EOF)
+        {
+            raw_read(semiprime, size);
+            semiprimes.push_back(semiprime);
+            sizes.push_back(size);
+            if(verify)
+            {
+                raw_read(first, factor_size);
+                raw_read(second, factor_size);
+                firsts.push_back(first);
+                seconds.push_back(second);
+            }
+        }
 
         auto start_time = std::chrono::high_resolution_clock::now();
-        bool success = fractor->handle(semiprime, left, right);
+        fractor->handle_batch(semiprimes, lefts, rights, successes);
         auto end_time = std::chrono::high_resolution_clock::now();
         using duration = std::chrono::duration<double, std::milli>;
-        duration elapsed = end_time - start_time;
-        if(show_time)
-            statistics::add_measurement(elapsed.count());
-
-        if(!success)
-        {
-            std::cerr << "Can't factor number(" << size;
-            std::cerr << " bytes): " << semiprime << std::endl;
-            statistics::show();
-            return -1;
-        }
+        // every number of a batch is given the mean time of the batch
+        duration elapsed = (end_time - start_time) / semiprimes.size();
 
-        if(verify)
+        for(usize q = 0; q < semiprimes.size(); ++q)
         {
-            raw_read(first, factor_size);
-            raw_read(second, factor_size);
+            semiprime = semiprimes[q];
+            size = sizes[q];
+            left = lefts[q];
+            right = rights[q];
+            if(show_time)
+                statistics::add_measurement(elapsed.count());
 
-            bool check_1 = (left == first) && (right == second);
-            bool check_2 = (right == first) && (left == second);
-            if(!(check_1 | check_2))
+            if(!successes[q])
             {
-                std::cerr << "Bad factorization:" << std::endl;
-                std::cerr << "    input(" << size << " bytes): ";
-                std::cerr << std::setw(output_width);
-                std::cerr << semiprime << std::endl;
-                std::cerr << "    expected: ";
-                std::cerr << std::setw(half_output_width) << first;
-                std::cerr << " * " << std::setw(half_output_width);
-                std::cerr << second << std::endl;
-                std::cerr << "    given:    ";
-                std::cerr << std::setw(half_output_width) << left;
-                std::cerr << " * " << std::setw(half_output_width);
-                std::cerr << right << std::endl;
+                std::cerr << "Can't factor number(" << size;
+                std::cerr << " bytes): " << semiprime << std::endl;
                 statistics::show();
                 return -1;
             }
-        }
 
-        std::cout << std::setw(output_width) << semiprime << " = ";
-        std::cout << std::setw(half_output_width) << left << " * ";
-        std::cout << std::setw(half_output_width) << right;
+            if(verify)
+            {
+                first = firsts[q];
+                second = seconds[q];
 
-        if(show_time)
-        {
-            std::cout << "   + " << std::setw(10); 
-            std::cout << static_cast<uint32>(elapsed.count()) << " ms";
-        }
+                bool check_1 = (left == first) && (right == second);
+                bool check_2 = (right == first) && (left == second);
+                if(!(check_1 | check_2))
+                {
+                    std::cerr << "Bad factorization:" << std::endl;
+                    std::cerr << "    input(" << size << " bytes): ";
+                    std::cerr << std::setw(output_width);
+                    std::cerr << semiprime << std::endl;
+                    std::cerr << "    expected: ";
+                    std::cerr << std::setw(half_output_width) << first;
+                    std::cerr << " * " << std::setw(half_output_width);
+                    std::cerr << second << std::endl;
+                    std::cerr << "    given:    ";
+                    std::cerr << std::setw(half_output_width) << left;
+                    std::cerr << " * " << std::setw(half_output_width);
+                    std::cerr << right << std::endl;
+                    statistics::show();
+                    return -1;
+                }
+            }
 
-        std::cout<< std::endl;
+            std::cout << std::setw(output_width) << semiprime << " = ";
+            std::cout << std::setw(half_output_width) << left << " * ";
+            std::cout << std::setw(half_output_width) << right;
+
+            if(show_time)
+            {
+                std::cout << "   + " << std::setw(10); 
+                std::cout << static_cast<uint32>(elapsed.count()) << " ms";
+            }
+
+            std::cout<< std::endl;
+        }
     }
     statistics::show();
+    if(show_time)
+        fractor->show_stats();
 }
@@ -1,11 +1,11 @@
 #include <algs/factor_ecm.h>
 #include <algs/factor_qs.h>
 #include <share/require.h>
-#include <gen/gen_prime.h>
 #include <fr/fractors.h>
 #include <share/rawio.h>
 #include <fr/fpgaio.h>
 #include <fr/comio.h>
+#include <iostream>
 #include <thread>
 
 bool QSFractor::handle
@@ -31,16 +31,83 @@ bool ECMFractor::handle
     intxx &right
 )
 {
+    if(!pool || pool->size() != nproc)
+        pool = std::make_unique<EcmPool>(nproc);
+
     std::atomic<bool> stop{false};
-    std::vector<intxx> result = factor_ECM_mt(semiprime, nproc, stop);
-    if(result.size() != 2)
+    FactorECMReturn result = factor_ECM_auto
+    (
+        semiprime,
+        *pool,
+        stop,
+        true,
+        checkpoint
+    );
+    stats += result.stats;
+    if(result.ret.size() != 2)
         return false;
 
-    left = result[0];
-    right = result[1];
+    left = result.ret[0];
+    right = result.ret[1];
     return true;
 }
 
+void ECMFractor::handle_batch
+(
+    const std::vector<intxx> &semiprimes,
+    std::vector<intxx> &left,
+    std::vector<intxx> &right,
+    std::vector<bool> &success
+)
+{
+    // a single number keeps the checkpoint of factor_ECM_auto
+    if(semiprimes.size() == 1)
+    {
+        FractorBase::handle_batch(semiprimes, left, right, success);
+        return;
+    }
+    if(!pool || pool->size() != nproc)
+        pool = std::make_unique<EcmPool>(nproc);
+
+    std::atomic<bool> stop{false};
+    FactorECMManyReturn result = factor_ECM_many
+    (
+        semiprimes,
+        *pool,
+        stop,
+        true
+    );
+    stats += result.stats;
+
+    left.assign(semiprimes.size(), 0);
+    right.assign(semiprimes.size(), 0);
+    success.assign(semiprimes.size(), false);
+    for(usize q = 0; q < semiprimes.size(); ++q)
+    {
+        const std::vector<intxx> &ret = result.ret[q].ret;
+        if(ret.size() != 2)
+            continue;
+
+        left[q] = ret[0];
+        right[q] = ret[1];
+        success[q] = true;
+    }
+}
+
+void ECMFractor::show_stats() const
+{
+    std::cout << "Curves:    " << stats.curves_started << " started, ";
+    std::cout << stats.curves_completed << " completed" << std::endl;
+    std::cout << "Stage 1:   " << stats.stage1_wall << " s wall, ";
+    std::cout << stats.stage1_cpu << " s cpu" << std::endl;
+    std::cout << "Stage 2:   " << stats.stage2_wall << " s wall, ";
+    std::cout << stats.stage2_cpu << " s cpu" << std::endl;
+    std::cout << "Mulmods:   " << stats.mulmods << std::endl;
+    std::cout << "Gcds:      " << stats.gcds << std::endl;
+    std::cout << "Curves/s:  " << stats.curves_per_second();
+    std::cout << " per thread" << std::endl;
+}
+
 bool HeteroFractor::handle
 (
     const intxx &semiprime,
@@ -50,36 +117,37 @@ bool HeteroFractor::handle
 {
     std::atomic<bool> success{false};
     std::atomic<bool> stop{false};
-    std::vector<intxx> result;
     std::thread soft_thread;
 
     if(use_cpu)
     {
+        if(!pool || pool->size() != nproc)
+            pool = std::make_unique<EcmPool>(nproc);
+
         soft_thread = std::thread(
         [
             &semiprime,
             &stop,
-            &result,
             &success,
             &left,
             &right
         ]
-        (int32 nproc)
+        (EcmPool *pool)
         {
             std::vector<intxx> soft_result = factor_ECM_mt
             (
                 semiprime,
-                nproc,
+                *pool,
                 stop
             );
             if(soft_result.size() == 2)
             {
                 if(success.exchange(true))
                     return;
-                left    = result[0];
-                right   = result[1];
+                left    = soft_result[0];
+                right   = soft_result[1];
             }
-        }, nproc);
+        }, pool.get());
     }
 
     byte buffer[fpgaio::io_buffer_size] = {};
@@ -96,8 +164,6 @@ bool HeteroFractor::handle
     d32  <<= 32;
     intxx d512N;
     intxx inv32;
-    gmp_randstate_t state;
-    init_state(state);
     mpz_mod(d512N.get_mpz_t(), d512.get_mpz_t(), semiprime.get_mpz_t());
     mpz_invert(inv32.get_mpz_t(), semiprime.get_mpz_t(), d32.get_mpz_t());
     raw_bwrite(buffer, semiprime, fpgaio::num_size);
@@ -114,26 +180,54 @@ bool HeteroFractor::handle
     require(recv_cmd == fpgaio::RSP_ACK, "No ACK for SET_N");
 
     int fpga_curves = 0;
-    intxx A24 = 0;
-    intxx x = 0;
+    // the FPGA takes the curve indices above the CPU ones, so both run
+    //     different Suyama curves of the same seed
+    uint64 next_curve = ECM_FPGA_FIRST_CURVE;
+    std::vector<Curve> curves;
+    intxx del;
     while(!stop)
     {
         while(fpga_curves < fpgaio::max_ladders)
         {
-            mpz_urandomb(A24.get_mpz_t(), state, fpgaio::num_size * 8);
-            mpz_urandomb(x.get_mpz_t(), state, fpgaio::num_size * 8);
+            if(curves.empty())
+            {
+                if(!generate_curves
+                (
+                    semiprime,
+                    ECM_DEFAULT_SEED,
+                    next_curve,
+                    fpgaio::max_ladders,
+                    curves,
+                    del
+                ))
+                {
+                    // the batch inversion has found a factor
+                    if(!success.exchange(true))
+                    {
+                        left = del;
+                        right = semiprime / del;
+                    }
+                    stop.store(true);
+                    break;
+                }
+                next_curve += fpgaio::max_ladders;
+                continue;
+            }
+
+            const Curve &curve = curves.back();
             raw_bwrite
             (
                 buffer,
-                A24 % semiprime,
+                curve.A24,
                 fpgaio::num_size
             );
             raw_bwrite
             (
                 buffer + fpgaio::num_size,
-                x % semiprime,
+                curve.x0,
                 fpgaio::num_size
             );
+            curves.pop_back();
             comio::send_packet
             (
                 fd,
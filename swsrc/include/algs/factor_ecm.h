@@ -1,8 +1,13 @@
 #ifndef FACTOR_ECM_HEADER
 #define FACTOR_ECM_HEADER
 
+#include <condition_variable>
+#include <functional>
 #include <atomic>
+#include <string>
 #include <vector>
+#include <thread>
+#include <mutex>
 
 #include "share/types.h"
 
@@ -12,45 +17,342 @@ enum class FactorEcmError
     no_found, // Too small B and С
 };
 
+// Montgomery curve with the starting point (x0 : 1), given in the same
+//     form the FPGA accepts it
+// A24 = (A + 2) / 4 (mod n)
+// sigma -- Suyama's parameter of the curve, 0 if it has none
 struct Curve
 {
+    intxx x0;
+    intxx A24;
+    uint64 sigma = 0;
+};
+
+// Master seed used when the caller does not pass one
+constexpr uint64 ECM_DEFAULT_SEED = 7;
+
+// Smallest Suyama parameter, sigma in {0, +-1, +-3, +-5} gives
+//     a singular curve
+constexpr uint64 ECM_SIGMA_MIN = 6;
+
+// First curve index of the FPGA. The CPU takes the indices below it, so
+//     with the same seed the two never run the same curve.
+constexpr uint64 ECM_FPGA_FIRST_CURVE = 1ull << 31;
+
+// Suyama's parameter of curve 'index' with the master seed 'seed'. The
+//     low 32 bits are ECM_SIGMA_MIN + index and the high bits come from
+//     the seed, so distinct indices below 2^32 never share a curve.
+uint64 suyama_sigma(uint64 seed, uint64 index);
+
+// Return Suyama's curves for the parameters 'sigmas'. They have a point
+//     of order 6 over Q and 12 divides their order modulo every p. All
+//     the curves share a single inversion modulo n. Curves that are
+//     singular modulo n are dropped, so 'curves' may be shorter than
+//     'sigmas'.
+// Returns false if a proper factor of n was found, then it is in 'del'
+bool suyama_curves(
+    const intxx& n,
+    const std::vector<uint64>& sigmas,
+    std::vector<Curve>& curves,
+    intxx& del
+);
+
+// The same for sigma = suyama_sigma(seed, index), index in
+//     [first, first + count)
+// The curves depend only on (seed, index), so a run is reproducible
+//     whatever thread generates them
+bool generate_curves(
+    const intxx& n,
+    uint64 seed,
+    uint64 first,
+    int32 count,
+    std::vector<Curve>& curves,
+    intxx& del
+);
+
+// Twisted Edwards curve -x^2 + y^2 = 1 + d * x^2 * y^2 with the starting
+//     point (x0, y0). 'mont' is the same curve in Montgomery form.
+struct EdwardsCurve
+{
+    intxx d;
     intxx x0;
     intxx y0;
-    intxx a;
-    intxx b;
+    Curve mont;
+};
+
+// Curve model used for stage 1
+// edwards -- a = -1 twisted Edwards curves in extended coordinates with
+//     a NAF multiplication, stage 1 is faster than the PRAC chains on
+//     Montgomery curves. Needs n coprime to 30, other n run on
+//     Montgomery curves.
+enum class EcmCurveForm
+{
+    montgomery,
+    edwards,
 };
 
-// Return random curve coefficients
-Curve generate_curve(const intxx& n);
+// Return an a = -1 twisted Edwards curve from Suyama's family, it has a
+//     point of order 6 over Q and 12 divides its order modulo every p.
+//     The curve depends only on (seed, index).
+// Returns false if an inversion modulo n failed, then 'del' is the gcd
+//     that made it fail: a proper factor of n, or n itself.
+bool generate_edwards_curve(
+    const intxx& n,
+    uint64 seed,
+    uint64 index,
+    EdwardsCurve& curve,
+    intxx& del
+);
+
+// The same for the indices [first, first + count). The curves are built
+//     together, so every step shares one inversion between all of them.
+// A curve whose inversion fails with the gcd n is dropped
+// Returns false if a proper factor of n was found, then it is in 'del'
+bool generate_edwards_curves(
+    const intxx& n,
+    uint64 seed,
+    uint64 first,
+    int32 count,
+    std::vector<EdwardsCurve>& curves,
+    intxx& del
+);
+
+// Counters of ECM runs. Every thread counts its own curves and the counts
+//     are summed when a task ends, so the curve code takes no locks.
+// Times are in seconds and summed over the threads, a stopped stage 1
+//     is counted too.
+// mulmods -- modular multiplications and squarings in the curve
+//     arithmetic, a batch of lanes counts every lane
+// gcds -- gcds with n after stage 1, in backtracking and in stage 2
+struct EcmStats
+{
+    int64 curves_started = 0;
+    int64 curves_completed = 0;
+    float64 stage1_wall = 0;
+    float64 stage1_cpu = 0;
+    float64 stage2_wall = 0;
+    float64 stage2_cpu = 0;
+    int64 mulmods = 0;
+    int64 gcds = 0;
+
+    EcmStats& operator+=(const EcmStats& other);
+
+    // Completed curves per second of one thread
+    float64 curves_per_second() const;
+};
 
 // ret is empty list if no factors found
-// B, C, curve_num values ​​for which the factorization was found
+// B, B2, C, curve_num values ​​for which the factorization was found
+// stats -- counters of the whole call
 struct FactorECMReturn
 {
     std::vector<intxx> ret;
-    int32 B;
+    int64 B;
+    int64 B2;
     int32 C;
     int32 attempts;
     FactorEcmError error;
+    EcmStats stats = {};
+};
+
+// Long-lived set of ECM worker threads. It is meant to be created once
+//     and reused for every attempt and every number, so that threads are
+//     not spawned and joined per call.
+class EcmPool
+{
+    std::vector<std::thread> threads;
+    std::mutex m;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+
+    // Current job, guarded by 'm'
+    const std::function<void(int32)>* task = nullptr;
+    int32 count = 0;
+    std::atomic<bool>* stop = nullptr;
+    uint64 generation = 0;
+    int32 busy = 0;
+    bool quit = false;
+
+    // Index of the next curve to hand out
+    std::atomic<int32> next{0};
+
+    void worker();
+
+    public:
+        // procs -- number of worker threads, a value below 1 starts one,
+        //     so that a job is never left without workers
+        explicit EcmPool(int32 procs);
+        ~EcmPool();
+
+        EcmPool(const EcmPool&) = delete;
+        EcmPool& operator=(const EcmPool&) = delete;
+
+        int32 size() const;
+
+        // Calls task(q) for every q in [0, count) and waits for the end.
+        //     Indices are handed out one at a time from a shared counter,
+        //     so all workers stay busy until the job is done. No new
+        //     index is handed out after 'stop' becomes true.
+        // Must not be called from several threads at once
+        void run(
+            int32 count,
+            std::atomic<bool>& stop,
+            const std::function<void(int32)>& task
+        );
 };
 
 // Factorize a number using the elliptic curve factorization method
-// B -- Upper limit
-// C -- Curves count
-// procs -- processors count
-// The variable "stop" is checked at each loop of the algorithm.
-//     If it is true, the loop is terminated. After the algorithm is
-//     completed, the variable will be true
+// B -- Upper limit (stage 1 bound)
+// B2 -- Stage 2 bound, ecm_params uses 10 times B (see its table in
+//     'algs/factor_ecm.cpp'). Stage 2 is skipped if B2 <= B
+// C -- Curves count (in total, not per processor)
+// procs -- processors count, below 1 means 1
+// The variable "stop" is checked before every prime of stage 1 and every
+//     giant step of stage 2. If it is true, the curves are abandoned.
+//     After the algorithm is completed, the variable will be true
 FactorECMReturn factor_ECM_parm(
     const intxx& n,
-    int32 B,
+    int64 B,
+    int64 B2,
     int32 C,
     int32 procs,
     std::atomic<bool>& stop,
     bool verbose
 );
 
+// The same, but curves are run on the workers of 'pool'
+// seed -- master seed, curve q is generate_curves(n, seed, q, ...), or
+//     generate_edwards_curves(n, seed, q, ...) for Edwards curves
+// form -- curve model of stage 1
+FactorECMReturn factor_ECM_parm(
+    const intxx& n,
+    int64 B,
+    int64 B2,
+    int32 C,
+    uint64 seed,
+    EcmPool& pool,
+    std::atomic<bool>& stop,
+    bool verbose,
+    EcmCurveForm form = EcmCurveForm::montgomery
+);
+
+// Stage 1 state of a curve, so that a later run with a larger B only
+//     multiplies by the prime powers the old bound left out
+// (X : Z) -- the point after stage 1 to B, (x0 : 1) with B = 1 before
+//     the first run
+// B2 -- stage 2 bound the curve went through without a factor, 0 if it
+//     has not
+struct EcmCurveState
+{
+    Curve curve;
+    intxx X;
+    intxx Z;
+    int64 B;
+    int64 B2 = 0;
+};
+
+// The same, but runs the curves 'states', their stage 1 continues from
+//     the bound each of them reached. Every curve that completes stage 1
+//     is left at the bound B, even if the run stops early.
+// States done with (B, B2), past B, or with Z = 0 are skipped
+// checkpoint -- if not empty, the run is saved there by
+//     save_ecm_checkpoint every 'checkpoint_interval' seconds and at the
+//     end. The file is removed when a factor is found.
+FactorECMReturn factor_ECM_parm(
+    const intxx& n,
+    int64 B,
+    int64 B2,
+    std::vector<EcmCurveState>& states,
+    EcmPool& pool,
+    std::atomic<bool>& stop,
+    bool verbose,
+    const std::string& checkpoint = {},
+    int32 checkpoint_interval = 60
+);
+
+// Stage 1 of a single curve from the bound it reached to B, on the
+//     calling thread in the scalar field for n. The state is left at B
+//     unless stopped.
+// Past its setup stage 1 makes no heap allocations: the curve keeps
+//     its temporaries and the prime and chain buffers are sized once.
+// Returns false if stopped
+bool ecm_stage1(
+    const intxx& n,
+    EcmCurveState& state,
+    int64 B,
+    const std::atomic<bool>& stop
+);
+
+// Write the curves of a run on n with the bounds B, B2 to a binary file.
+//     A curve is kept as its sigma and its point, the rest is rebuilt.
+// The file is replaced atomically, a crash leaves the old one
+// Returns false if the file can't be written
+bool save_ecm_checkpoint(
+    const std::string& path,
+    const intxx& n,
+    int64 B,
+    int64 B2,
+    const std::vector<EcmCurveState>& states
+);
+
+// Read a file written by save_ecm_checkpoint
+// Returns false if it can't be read or is malformed, the arguments are
+//     left in an unspecified state then
+bool load_ecm_checkpoint(
+    const std::string& path,
+    intxx& n,
+    int64& B,
+    int64& B2,
+    std::vector<EcmCurveState>& states
+);
+
+// ECM parameters for n of at most 'bits' bits
+// C -- expected number of curves to find a factor of bits / 2 bits
+struct EcmParams
+{
+    int32 bits;
+    int64 B;
+    int64 B2;
+    int32 C;
+};
+
+// Parameters for n from the table, the first row that fits its size
+// step -- take the row that many places further. Past the last row B,
+//     B2 and C double at every step.
+EcmParams ecm_params(const intxx& n, int32 step = 0);
+
+// Replace the built-in table by the one from a text file. Every line is
+//     "bits B B2 C", rows sorted by bits, '#' starts a comment.
+// Not thread-safe, call it before any factorization
+// Returns false if the file can't be read or is malformed, the table is
+//     kept then
+bool load_ecm_params(const std::string& path);
+
+// Arithmetic of stage 1 and stage 2
+// automatic -- the widest vector kernel the processor has, the default
+// scalar -- one curve at a time in Montgomery or mpz arithmetic
+// avx2, ifma -- a batch of curves in the lanes of 'MontBatchField' from
+//     'algs/mod_arith_simd.h', for odd n of at most 1024 bits
+enum class EcmKernel
+{
+    automatic,
+    scalar,
+    avx2,
+    ifma,
+};
+
+// Whether the processor and the build can run 'kernel'
+bool ecm_kernel_supported(EcmKernel kernel);
+
+// Use 'kernel' for every later factorization instead of the automatic
+//     choice, a kernel that is not supported or does not fit n is
+//     replaced by the automatic one. For tests and benchmarks.
+// Not thread-safe, call it before any factorization
+void set_ecm_kernel(EcmKernel kernel);
+
 // Factorize a number using the elliptic curve factorization method
+// B, B2 and C are taken from the table by the size of n
+// procs -- processors count, below 1 means 1
 FactorECMReturn factor_ECM_auto(
     const intxx& n,
     int32 procs,
@@ -58,6 +360,41 @@ FactorECMReturn factor_ECM_auto(
     bool verbose
 );
 
+// The same, but curves are run on the workers of 'pool'
+// checkpoint -- if not empty, every attempt is saved there and a run on
+//     the same n resumes from the file. Completed curves are not run
+//     again.
+FactorECMReturn factor_ECM_auto(
+    const intxx& n,
+    EcmPool& pool,
+    std::atomic<bool>& stop,
+    bool verbose,
+    const std::string& checkpoint = {}
+);
+
+// ret -- one result per number, in the order of the numbers
+// stats -- counters of the whole run
+struct FactorECMManyReturn
+{
+    std::vector<FactorECMReturn> ret;
+    EcmStats stats;
+};
+
+// Factorize many numbers at once. The lanes of a batch hold curves of
+//     different numbers, one modulus per lane, so the vector kernels stay
+//     full even when a number needs only a few curves, and every batch
+//     shares the primes and the PRAC chains of stage 1.
+// Every number runs the curves and bounds of factor_ECM_auto, in rounds:
+//     a round gives each number that is not split its next curves, and
+//     a number leaves as soon as one of its curves splits it.
+// 'stop' ends the run, the numbers left are not found
+FactorECMManyReturn factor_ECM_many(
+    const std::vector<intxx>& numbers,
+    EcmPool& pool,
+    std::atomic<bool>& stop,
+    bool verbose
+);
+
 // Factorize a number using the elliptic curve factorization method
 // Parameters will be selected based on the length of the number
 // The variable is checked at each loop of the algorithm. If it is true,
@@ -68,7 +405,7 @@ std::vector<intxx> factor_ECM(const intxx& n);
 
 // Factorize a number using the elliptic curve factorization method
 // Parameters will be selected based on the length of the number
-// procs -- processors count
+// procs -- processors count, below 1 means 1
 // The variable is checked at each loop of the algorithm. If it is true,
 //     the loop is terminated. After the algorithm is completed, the
 //     variable will be true
@@ -79,4 +416,14 @@ std::vector<intxx> factor_ECM_mt(
     std::atomic<bool>& stop
 );
 
+// The same, but curves are run on the workers of 'pool'
+// checkpoint -- file to save the run to and resume it from, see
+//     factor_ECM_auto
+std::vector<intxx> factor_ECM_mt(
+    const intxx& n,
+    EcmPool& pool,
+    std::atomic<bool>& stop,
+    const std::string& checkpoint = {}
+);
+
 #endif // FACTOR_ECM_HEADER
@@ -11,9 +11,9 @@ enum class FactorQsError {
     no_deps, // No linear relationships found
 };
 
-// Factorize a number using the quadratic sieve method
+// Factorize a number using the self-initialising quadratic sieve
 // B -- Smoothness boundary
-// M -- Sieve interval size
+// M -- Every polynomial is sieved for x from [-M, M]
 // May returns empty list if no factors found
 std::vector<intxx> factor_QS_parm(
     const intxx& n,
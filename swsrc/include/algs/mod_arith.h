@@ -0,0 +1,282 @@
+#ifndef MOD_ARITH_HEADER
+#define MOD_ARITH_HEADER
+
+#include <gmp.h>
+
+#include "share/types.h"
+
+// Arithmetic modulo n for the ECM engine. Every field has the same
+//     interface, so the curve code is written once as a template:
+//     Elem -- type of a residue
+//     set(r, a) / get(a) -- conversion from / to a plain intxx
+//     add, sub, mul, sqr -- r may alias any argument
+//     inv(r, a) -- returns false if a is not invertible
+//     lanes, set_lane / get_lane, modulus(lane) -- a scalar field has the
+//     single lane 0, so the curve code can treat it as a batch field
+//     from 'algs/mod_arith_simd.h'
+
+// Generic field on top of mpz, for any n
+class MpzField
+{
+    intxx n;
+
+    public:
+        using Elem = intxx;
+
+        explicit MpzField(const intxx& n)
+            : n(n)
+        {}
+
+        const intxx& modulus() const
+        {
+            return n;
+        }
+
+        const intxx& modulus(int32) const
+        {
+            return n;
+        }
+
+        void set(Elem& r, const intxx& a) const
+        {
+            mpz_mod(r.get_mpz_t(), a.get_mpz_t(), n.get_mpz_t());
+        }
+
+        intxx get(const Elem& a) const
+        {
+            return a;
+        }
+
+        static constexpr int32 lanes = 1;
+
+        void set_lane(Elem& r, int32, const intxx& a) const
+        {
+            set(r, a);
+        }
+
+        intxx get_lane(const Elem& a, int32) const
+        {
+            return get(a);
+        }
+
+        void add(Elem& r, const Elem& a, const Elem& b) const
+        {
+            mpz_add(r.get_mpz_t(), a.get_mpz_t(), b.get_mpz_t());
+            if (0 <= mpz_cmp(r.get_mpz_t(), n.get_mpz_t()))
+            {
+                mpz_sub(r.get_mpz_t(), r.get_mpz_t(), n.get_mpz_t());
+            }
+        }
+
+        void sub(Elem& r, const Elem& a, const Elem& b) const
+        {
+            mpz_sub(r.get_mpz_t(), a.get_mpz_t(), b.get_mpz_t());
+            if (mpz_sgn(r.get_mpz_t()) < 0)
+            {
+                mpz_add(r.get_mpz_t(), r.get_mpz_t(), n.get_mpz_t());
+            }
+        }
+
+        void mul(Elem& r, const Elem& a, const Elem& b) const
+        {
+            mpz_mul(r.get_mpz_t(), a.get_mpz_t(), b.get_mpz_t());
+            mpz_mod(r.get_mpz_t(), r.get_mpz_t(), n.get_mpz_t());
+        }
+
+        void sqr(Elem& r, const Elem& a) const
+        {
+            mul(r, a, a);
+        }
+
+        bool inv(Elem& r, const Elem& a) const
+        {
+            return mpz_invert(r.get_mpz_t(), a.get_mpz_t(), n.get_mpz_t());
+        }
+};
+
+// Montgomery arithmetic for an odd n of at most 64 * L bits. Residues
+//     are stored as a * R mod n, R = 2^(64 * L), in L limbs on the stack,
+//     so no operation allocates memory.
+// The reduction is REDC with n' = -n^(-1) mod 2^64, the same contract as
+//     'hwsrc/ecm/mont_mul.sv' with its 32-bit words. For L = 4 the value
+//     R^2 mod n is the 'd512N' that HeteroFractor sends to the FPGA.
+template<int32 L>
+class MontField
+{
+    static_assert(GMP_LIMB_BITS == 64, "64-bit GMP limbs expected");
+
+    public:
+        struct Elem
+        {
+            mp_limb_t d[L];
+        };
+
+    private:
+        using uint128 = unsigned __int128;
+
+        intxx n;
+        Elem N;
+        mp_limb_t n_inv; // -N^(-1) mod 2^64
+        Elem R2;         // R^2 mod N
+        Elem one;        // plain 1, for leaving the Montgomery form
+
+        static void load(Elem& r, const intxx& a)
+        {
+            for (int32 q = 0; q < L; ++q)
+            {
+                r.d[q] = mpz_getlimbn(a.get_mpz_t(), q);
+            }
+        }
+
+    public:
+        explicit MontField(const intxx& n)
+            : n(n)
+        {
+            load(N, n);
+
+            // Newton iteration, each step doubles the number of
+            //     correct low bits of the inverse
+            mp_limb_t inv = N.d[0];
+            for (int32 q = 0; q < 5; ++q)
+            {
+                inv *= 2 - N.d[0] * inv;
+            }
+            n_inv = -inv;
+
+            intxx r2 = 1;
+            r2 <<= 2 * 64 * L;
+            r2 %= n;
+            load(R2, r2);
+
+            one = Elem{};
+            one.d[0] = 1;
+        }
+
+        const intxx& modulus() const
+        {
+            return n;
+        }
+
+        const intxx& modulus(int32) const
+        {
+            return n;
+        }
+
+        void set(Elem& r, const intxx& a) const
+        {
+            intxx t;
+            mpz_mod(t.get_mpz_t(), a.get_mpz_t(), n.get_mpz_t());
+            Elem plain;
+            load(plain, t);
+            mul(r, plain, R2);
+        }
+
+        intxx get(const Elem& a) const
+        {
+            Elem plain;
+            mul(plain, a, one);
+            intxx r;
+            mpz_import(
+                r.get_mpz_t(),
+                L,
+                -1,                 // least significant limb first
+                sizeof(mp_limb_t),
+                0,                  // native endianness
+                0,
+                plain.d
+            );
+            return r;
+        }
+
+        static constexpr int32 lanes = 1;
+
+        void set_lane(Elem& r, int32, const intxx& a) const
+        {
+            set(r, a);
+        }
+
+        intxx get_lane(const Elem& a, int32) const
+        {
+            return get(a);
+        }
+
+        void add(Elem& r, const Elem& a, const Elem& b) const
+        {
+            mp_limb_t carry = mpn_add_n(r.d, a.d, b.d, L);
+            if (carry || 0 <= mpn_cmp(r.d, N.d, L))
+            {
+                mpn_sub_n(r.d, r.d, N.d, L);
+            }
+        }
+
+        void sub(Elem& r, const Elem& a, const Elem& b) const
+        {
+            if (mpn_sub_n(r.d, a.d, b.d, L))
+            {
+                mpn_add_n(r.d, r.d, N.d, L);
+            }
+        }
+
+        // r = a * b / R (mod N), coarsely integrated operand scanning
+        void mul(Elem& r, const Elem& a, const Elem& b) const
+        {
+            mp_limb_t t[L + 2] = {};
+            for (int32 i = 0; i < L; ++i)
+            {
+                uint128 c = 0;
+                for (int32 j = 0; j < L; ++j)
+                {
+                    c += static_cast<uint128>(a.d[j]) * b.d[i] + t[j];
+                    t[j] = static_cast<mp_limb_t>(c);
+                    c >>= 64;
+                }
+                c += t[L];
+                t[L] = static_cast<mp_limb_t>(c);
+                t[L + 1] = static_cast<mp_limb_t>(c >> 64);
+
+                const mp_limb_t m = t[0] * n_inv;
+                c = static_cast<uint128>(m) * N.d[0] + t[0];
+                c >>= 64;
+                for (int32 j = 1; j < L; ++j)
+                {
+                    c += static_cast<uint128>(m) * N.d[j] + t[j];
+                    t[j - 1] = static_cast<mp_limb_t>(c);
+                    c >>= 64;
+                }
+                c += t[L];
+                t[L - 1] = static_cast<mp_limb_t>(c);
+                t[L] = t[L + 1] + static_cast<mp_limb_t>(c >> 64);
+            }
+
+            // t < 2 * N
+            if (t[L] || 0 <= mpn_cmp(t, N.d, L))
+            {
+                mpn_sub_n(r.d, t, N.d, L);
+            }
+            else
+            {
+                for (int32 q = 0; q < L; ++q)
+                {
+                    r.d[q] = t[q];
+                }
+            }
+        }
+
+        void sqr(Elem& r, const Elem& a) const
+        {
+            mul(r, a, a);
+        }
+
+        bool inv(Elem& r, const Elem& a) const
+        {
+            intxx t = get(a);
+            if (!mpz_invert(t.get_mpz_t(), t.get_mpz_t(), n.get_mpz_t()))
+            {
+                return false;
+            }
+            set(r, t);
+            return true;
+        }
+};
+
+#endif // MOD_ARITH_HEADER
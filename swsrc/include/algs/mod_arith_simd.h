@@ -0,0 +1,556 @@
+#ifndef MOD_ARITH_SIMD_HEADER
+#define MOD_ARITH_SIMD_HEADER
+
+#include <gmp.h>
+#include <vector>
+
+#include "share/types.h"
+
+// Lane-parallel Montgomery arithmetic for the batched ECM engine. One
+//     Elem holds W residues, one per curve, and every operation is done
+//     on all W lanes at once. The interface is the one of the fields
+//     from 'algs/mod_arith.h', so 'MontgomeryCurve' runs on it unchanged;
+//     set_lane / get_lane move single values in and out.
+// Every lane has its own modulus, all of them odd and below R.
+//
+// The vector kernels are compiled for their instruction set with a
+//     function attribute and are only called after 'supported()' is
+//     checked at run time, so the binary itself needs no -m flags.
+// Layout is structure of arrays, limb-major: d[j * W + lane] is limb j of
+//     the lane. Limbs are BITS wide and kept normalized between
+//     operations; inside a multiplication they carry lazily in 64 bits.
+// The limb loops are unrolled explicitly, so that the accumulators stay
+//     in registers with the -O2 of the Makefiles.
+
+#if defined(__x86_64__)
+#define MOD_ARITH_SIMD 1
+#include <immintrin.h>
+#endif
+
+#if MOD_ARITH_SIMD
+
+// AVX-512 IFMA: 8 lanes of 52-bit limbs, 52 x 52 -> 104-bit products
+//     accumulated by vpmadd52luq / vpmadd52huq
+template<int32 L>
+struct Ifma52Kernel
+{
+    static constexpr int32 W = 8;
+    static constexpr int32 BITS = 52;
+    static constexpr int32 LIMBS = L;
+
+    static bool supported()
+    {
+        return __builtin_cpu_supports("avx512f")
+            && __builtin_cpu_supports("avx512ifma");
+    }
+
+    // r = a * b / R (mod N), R = 2^(52 * L)
+    // n_inv = -N^(-1) mod 2^52
+    __attribute__((target("avx512f,avx512ifma")))
+    static void mul(
+        uint64* r,
+        const uint64* a,
+        const uint64* b,
+        const uint64* N,
+        const uint64* N_comp,
+        const uint64* n_inv
+    )
+    {
+        const __m512i zero = _mm512_setzero_si512();
+        const __m512i inv = _mm512_loadu_si512(n_inv);
+        __m512i t[L + 1];
+        #pragma GCC unroll 64
+        for (int32 j = 0; j <= L; ++j)
+        {
+            t[j] = zero;
+        }
+
+        for (int32 i = 0; i < L; ++i)
+        {
+            const __m512i bi = _mm512_loadu_si512(b + i * W);
+            #pragma GCC unroll 64
+            for (int32 j = 0; j < L; ++j)
+            {
+                const __m512i aj = _mm512_loadu_si512(a + j * W);
+                t[j] = _mm512_madd52lo_epu64(t[j], aj, bi);
+                t[j + 1] = _mm512_madd52hi_epu64(t[j + 1], aj, bi);
+            }
+
+            const __m512i m = _mm512_madd52lo_epu64(zero, t[0], inv);
+            #pragma GCC unroll 64
+            for (int32 j = 0; j < L; ++j)
+            {
+                const __m512i Nj = _mm512_loadu_si512(N + j * W);
+                t[j] = _mm512_madd52lo_epu64(t[j], m, Nj);
+                t[j + 1] = _mm512_madd52hi_epu64(t[j + 1], m, Nj);
+            }
+
+            // The low 52 bits of t[0] are zero now, drop the limb
+            const __m512i carry = high(t[0]);
+            #pragma GCC unroll 64
+            for (int32 j = 0; j < L; ++j)
+            {
+                t[j] = t[j + 1];
+            }
+            t[L] = zero;
+            t[0] = _mm512_add_epi64(t[0], carry);
+        }
+
+        reduce(r, t, N_comp);
+    }
+
+    // r = a + b (mod N)
+    __attribute__((target("avx512f,avx512ifma")))
+    static void add(
+        uint64* r,
+        const uint64* a,
+        const uint64* b,
+        const uint64* N_comp
+    )
+    {
+        __m512i t[L + 1];
+        #pragma GCC unroll 64
+        for (int32 j = 0; j < L; ++j)
+        {
+            t[j] = _mm512_add_epi64(
+                _mm512_loadu_si512(a + j * W),
+                _mm512_loadu_si512(b + j * W)
+            );
+        }
+        t[L] = _mm512_setzero_si512();
+        reduce(r, t, N_comp);
+    }
+
+    // r = a - b (mod N)
+    __attribute__((target("avx512f,avx512ifma")))
+    static void sub(
+        uint64* r,
+        const uint64* a,
+        const uint64* b,
+        const uint64* N
+    )
+    {
+        const __m512i mask = _mm512_set1_epi64((uint64(1) << BITS) - 1);
+
+        // t = a + (R - 1 - b) + 1 = a - b + R
+        __m512i t[L];
+        __m512i carry = _mm512_set1_epi64(1);
+        #pragma GCC unroll 64
+        for (int32 j = 0; j < L; ++j)
+        {
+            __m512i s = _mm512_sub_epi64(
+                mask,
+                _mm512_loadu_si512(b + j * W)
+            );
+            s = _mm512_add_epi64(s, _mm512_loadu_si512(a + j * W));
+            s = _mm512_add_epi64(s, carry);
+            carry = high(s);
+            t[j] = _mm512_and_si512(s, mask);
+        }
+        // No carry out of R means a < b, then N is added back
+        const __mmask8 borrow = _mm512_cmpeq_epi64_mask(
+            carry,
+            _mm512_setzero_si512()
+        );
+
+        carry = _mm512_setzero_si512();
+        #pragma GCC unroll 64
+        for (int32 j = 0; j < L; ++j)
+        {
+            __m512i s = _mm512_add_epi64(t[j], _mm512_loadu_si512(N + j * W));
+            s = _mm512_add_epi64(s, carry);
+            carry = high(s);
+            s = _mm512_and_si512(s, mask);
+            _mm512_storeu_si512(
+                r + j * W,
+                _mm512_mask_blend_epi64(borrow, t[j], s)
+            );
+        }
+    }
+
+    private:
+        // x >> BITS
+        // The zero-masked form, _mm512_srli_epi64 trips a false
+        //     -Wuninitialized in GCC 12 on its undefined pass-through
+        __attribute__((target("avx512f,avx512ifma")))
+        static __m512i high(__m512i x)
+        {
+            return _mm512_maskz_srli_epi64(0xFF, x, BITS);
+        }
+
+        // r = t mod N for t < 2 * N, limbs of t are not normalized, so
+        //     t[L] is 0 or 1 after the carries
+        // N_comp = R - N
+        __attribute__((target("avx512f,avx512ifma")))
+        static void reduce(uint64* r, __m512i (&t)[L + 1], const uint64* N_comp)
+        {
+            const __m512i mask = _mm512_set1_epi64((uint64(1) << BITS) - 1);
+
+            #pragma GCC unroll 64
+            for (int32 j = 0; j < L; ++j)
+            {
+                t[j + 1] = _mm512_add_epi64(t[j + 1], high(t[j]));
+                t[j] = _mm512_and_si512(t[j], mask);
+            }
+
+            // u = (t mod R) + R - N, t >= N exactly when u or t itself
+            //     reaches R
+            __m512i u[L];
+            __m512i carry = _mm512_setzero_si512();
+            #pragma GCC unroll 64
+            for (int32 j = 0; j < L; ++j)
+            {
+                __m512i s = _mm512_add_epi64(
+                    t[j],
+                    _mm512_loadu_si512(N_comp + j * W)
+                );
+                s = _mm512_add_epi64(s, carry);
+                carry = high(s);
+                u[j] = _mm512_and_si512(s, mask);
+            }
+            const __mmask8 less = _mm512_cmpeq_epi64_mask(
+                _mm512_or_si512(carry, t[L]),
+                _mm512_setzero_si512()
+            );
+
+            #pragma GCC unroll 64
+            for (int32 j = 0; j < L; ++j)
+            {
+                _mm512_storeu_si512(
+                    r + j * W,
+                    _mm512_mask_blend_epi64(less, u[j], t[j])
+                );
+            }
+        }
+};
+
+// AVX2: 4 lanes of 26-bit limbs, so that the 32 x 32 -> 64-bit vpmuludq
+//     gives exact products that can be summed without carrying
+template<int32 L>
+struct Avx2Kernel
+{
+    static constexpr int32 W = 4;
+    static constexpr int32 BITS = 26;
+    static constexpr int32 LIMBS = L;
+
+    static bool supported()
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+
+    // r = a * b / R (mod N), R = 2^(26 * L)
+    // n_inv = -N^(-1) mod 2^26
+    __attribute__((target("avx2")))
+    static void mul(
+        uint64* r,
+        const uint64* a,
+        const uint64* b,
+        const uint64* N,
+        const uint64* N_comp,
+        const uint64* n_inv
+    )
+    {
+        const __m256i mask = _mm256_set1_epi64x((uint64(1) << BITS) - 1);
+        const __m256i inv = load(n_inv);
+        __m256i t[L + 1];
+        #pragma GCC unroll 64
+        for (int32 j = 0; j <= L; ++j)
+        {
+            t[j] = _mm256_setzero_si256();
+        }
+
+        for (int32 i = 0; i < L; ++i)
+        {
+            const __m256i bi = load(b + i * W);
+            #pragma GCC unroll 64
+            for (int32 j = 0; j < L; ++j)
+            {
+                const __m256i p = _mm256_mul_epu32(load(a + j * W), bi);
+                t[j] = _mm256_add_epi64(t[j], p);
+            }
+
+            const __m256i m = _mm256_and_si256(
+                _mm256_mul_epu32(t[0], inv),
+                mask
+            );
+            #pragma GCC unroll 64
+            for (int32 j = 0; j < L; ++j)
+            {
+                const __m256i p = _mm256_mul_epu32(m, load(N + j * W));
+                t[j] = _mm256_add_epi64(t[j], p);
+            }
+
+            // The low 26 bits of t[0] are zero now, drop the limb
+            const __m256i carry = _mm256_srli_epi64(t[0], BITS);
+            #pragma GCC unroll 64
+            for (int32 j = 0; j < L; ++j)
+            {
+                t[j] = t[j + 1];
+            }
+            t[0] = _mm256_add_epi64(t[0], carry);
+        }
+        t[L] = _mm256_setzero_si256();
+
+        reduce(r, t, N_comp);
+    }
+
+    // r = a + b (mod N)
+    __attribute__((target("avx2")))
+    static void add(
+        uint64* r,
+        const uint64* a,
+        const uint64* b,
+        const uint64* N_comp
+    )
+    {
+        __m256i t[L + 1];
+        #pragma GCC unroll 64
+        for (int32 j = 0; j < L; ++j)
+        {
+            t[j] = _mm256_add_epi64(load(a + j * W), load(b + j * W));
+        }
+        t[L] = _mm256_setzero_si256();
+        reduce(r, t, N_comp);
+    }
+
+    // r = a - b (mod N)
+    __attribute__((target("avx2")))
+    static void sub(
+        uint64* r,
+        const uint64* a,
+        const uint64* b,
+        const uint64* N
+    )
+    {
+        const __m256i mask = _mm256_set1_epi64x((uint64(1) << BITS) - 1);
+
+        // t = a + (R - 1 - b) + 1 = a - b + R
+        __m256i t[L];
+        __m256i carry = _mm256_set1_epi64x(1);
+        #pragma GCC unroll 64
+        for (int32 j = 0; j < L; ++j)
+        {
+            __m256i s = _mm256_sub_epi64(mask, load(b + j * W));
+            s = _mm256_add_epi64(s, load(a + j * W));
+            s = _mm256_add_epi64(s, carry);
+            carry = _mm256_srli_epi64(s, BITS);
+            t[j] = _mm256_and_si256(s, mask);
+        }
+        // No carry out of R means a < b, then N is added back
+        const __m256i borrow = _mm256_cmpeq_epi64(
+            carry,
+            _mm256_setzero_si256()
+        );
+
+        carry = _mm256_setzero_si256();
+        #pragma GCC unroll 64
+        for (int32 j = 0; j < L; ++j)
+        {
+            __m256i s = _mm256_add_epi64(t[j], load(N + j * W));
+            s = _mm256_add_epi64(s, carry);
+            carry = _mm256_srli_epi64(s, BITS);
+            s = _mm256_and_si256(s, mask);
+            store(r + j * W, _mm256_blendv_epi8(t[j], s, borrow));
+        }
+    }
+
+    private:
+        __attribute__((target("avx2")))
+        static __m256i load(const uint64* p)
+        {
+            return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        }
+
+        __attribute__((target("avx2")))
+        static void store(uint64* p, __m256i v)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+        }
+
+        // r = t mod N for t < 2 * N, limbs of t are not normalized, so
+        //     t[L] is 0 or 1 after the carries
+        // N_comp = R - N
+        __attribute__((target("avx2")))
+        static void reduce(uint64* r, __m256i (&t)[L + 1], const uint64* N_comp)
+        {
+            const __m256i mask = _mm256_set1_epi64x((uint64(1) << BITS) - 1);
+
+            #pragma GCC unroll 64
+            for (int32 j = 0; j < L; ++j)
+            {
+                const __m256i carry = _mm256_srli_epi64(t[j], BITS);
+                t[j + 1] = _mm256_add_epi64(t[j + 1], carry);
+                t[j] = _mm256_and_si256(t[j], mask);
+            }
+
+            // u = (t mod R) + R - N, t >= N exactly when u or t itself
+            //     reaches R
+            __m256i u[L];
+            __m256i carry = _mm256_setzero_si256();
+            #pragma GCC unroll 64
+            for (int32 j = 0; j < L; ++j)
+            {
+                __m256i s = _mm256_add_epi64(t[j], load(N_comp + j * W));
+                s = _mm256_add_epi64(s, carry);
+                carry = _mm256_srli_epi64(s, BITS);
+                u[j] = _mm256_and_si256(s, mask);
+            }
+            const __m256i less = _mm256_cmpeq_epi64(
+                _mm256_or_si256(carry, t[L]),
+                _mm256_setzero_si256()
+            );
+
+            #pragma GCC unroll 64
+            for (int32 j = 0; j < L; ++j)
+            {
+                store(r + j * W, _mm256_blendv_epi8(u[j], t[j], less));
+            }
+        }
+};
+
+#endif // MOD_ARITH_SIMD
+
+// Field of W residues on top of one of the kernels above
+template<typename Kernel>
+class MontBatchField
+{
+    static constexpr int32 W = Kernel::W;
+    static constexpr int32 L = Kernel::LIMBS;
+    static constexpr int32 BITS = Kernel::BITS;
+
+    public:
+        static constexpr int32 lanes = W;
+
+        struct Elem
+        {
+            alignas(64) uint64 d[L * W];
+        };
+
+    private:
+        intxx n[W];
+        Elem N;
+        Elem N_comp;      // R - N
+        uint64 n_inv[W];  // -N^(-1) mod 2^BITS
+
+        // Writes a < R into the limbs of 'lane'
+        static void load(Elem& r, int32 lane, const intxx& a)
+        {
+            intxx t = a;
+            #pragma GCC unroll 64
+            for (int32 j = 0; j < L; ++j)
+            {
+                r.d[j * W + lane] = mpz_getlimbn(t.get_mpz_t(), 0)
+                                  & ((uint64(1) << BITS) - 1);
+                t >>= BITS;
+            }
+        }
+
+        static intxx unload(const Elem& a, int32 lane)
+        {
+            intxx r = 0;
+            #pragma GCC unroll 64
+            for (int32 j = L - 1; 0 <= j; --j)
+            {
+                r <<= BITS;
+                r += static_cast<unsigned long>(a.d[j * W + lane]);
+            }
+            return r;
+        }
+
+    public:
+        // One modulus for every lane
+        explicit MontBatchField(const intxx& n)
+            : MontBatchField(std::vector<intxx>{n})
+        {}
+
+        // Modulus moduli[lane] in every lane, the lanes past the end
+        //     repeat the first one
+        explicit MontBatchField(const std::vector<intxx>& moduli)
+        {
+            intxx R = 1;
+            R <<= BITS * L;
+            for (int32 lane = 0; lane < W; ++lane)
+            {
+                const usize q = static_cast<usize>(lane) < moduli.size()
+                              ? lane
+                              : 0;
+                const intxx& n = moduli[q];
+                this->n[lane] = n;
+                load(N, lane, n);
+                load(N_comp, lane, R - n);
+
+                uint64 inv = N.d[lane];
+                for (int32 q = 0; q < 5; ++q)
+                {
+                    inv *= 2 - N.d[lane] * inv;
+                }
+                n_inv[lane] = -inv & ((uint64(1) << BITS) - 1);
+            }
+        }
+
+        static bool supported()
+        {
+            return Kernel::supported();
+        }
+
+        // Largest modulus size in bits the kernel works with
+        static constexpr usize max_bits()
+        {
+            return BITS * L - 1;
+        }
+
+        const intxx& modulus(int32 lane) const
+        {
+            return n[lane];
+        }
+
+        // The same value in every lane
+        void set(Elem& r, const intxx& a) const
+        {
+            for (int32 lane = 0; lane < W; ++lane)
+            {
+                set_lane(r, lane, a);
+            }
+        }
+
+        void set_lane(Elem& r, int32 lane, const intxx& a) const
+        {
+            intxx t = a;
+            t <<= BITS * L;
+            t %= n[lane];
+            load(r, lane, t);
+        }
+
+        intxx get_lane(const Elem& a, int32 lane) const
+        {
+            intxx R = 1;
+            R <<= BITS * L;
+            intxx R_inv;
+            mpz_invert(R_inv.get_mpz_t(), R.get_mpz_t(), n[lane].get_mpz_t());
+            intxx r = unload(a, lane) * R_inv;
+            r %= n[lane];
+            return r;
+        }
+
+        void add(Elem& r, const Elem& a, const Elem& b) const
+        {
+            Kernel::add(r.d, a.d, b.d, N_comp.d);
+        }
+
+        void sub(Elem& r, const Elem& a, const Elem& b) const
+        {
+            Kernel::sub(r.d, a.d, b.d, N.d);
+        }
+
+        void mul(Elem& r, const Elem& a, const Elem& b) const
+        {
+            Kernel::mul(r.d, a.d, b.d, N.d, N_comp.d, n_inv);
+        }
+
+        void sqr(Elem& r, const Elem& a) const
+        {
+            mul(r, a, a);
+        }
+};
+
+#endif // MOD_ARITH_SIMD_HEADER
@@ -2,6 +2,7 @@
 #define FRACTOR_BASE_HEADER
 
 #include <share/types.h>
+#include <vector>
 
 class FractorBase
 {
@@ -17,8 +18,30 @@ public:
         intxx &right
     ) = 0;
 
+    // factors several numbers at once, fractors that can't just
+    // take them one by one
+    // success[q] is true if semiprimes[q] was factored
+    virtual void handle_batch
+    (
+        const std::vector<intxx> &semiprimes,
+        std::vector<intxx> &left,
+        std::vector<intxx> &right,
+        std::vector<bool> &success
+    )
+    {
+        left.assign(semiprimes.size(), 0);
+        right.assign(semiprimes.size(), 0);
+        success.assign(semiprimes.size(), false);
+        for(usize q = 0; q < semiprimes.size(); ++q)
+            success[q] = handle(semiprimes[q], left[q], right[q]);
+    }
+
     virtual ~FractorBase() = default;
 
+    // prints the counters collected over all the numbers, if the
+    // fractor keeps any
+    virtual void show_stats() const {}
+
     void set_nproc(int32 nproc)
     {
         this->nproc = nproc;
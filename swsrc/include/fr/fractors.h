@@ -2,6 +2,9 @@
 #define FRACTORS_HEADER
 
 #include <fr/fractor_base.h>
+#include <algs/factor_ecm.h>
+#include <memory>
+#include <string>
 
 class QSFractor : public FractorBase
 {
@@ -16,6 +19,14 @@ public:
 
 class ECMFractor : public FractorBase
 {
+private:
+    // created on the first number, lives until the fractor is destroyed
+    std::unique_ptr<EcmPool> pool;
+    // file the run is saved to and resumed from, none if empty
+    std::string checkpoint;
+    // summed over all the numbers
+    EcmStats stats;
+
 public:
     bool handle
     (
@@ -23,6 +34,22 @@ public:
         intxx &left,
         intxx &right
     ) override;
+
+    // all the numbers go through one multi-number ECM run
+    void handle_batch
+    (
+        const std::vector<intxx> &semiprimes,
+        std::vector<intxx> &left,
+        std::vector<intxx> &right,
+        std::vector<bool> &success
+    ) override;
+
+    void show_stats() const override;
+
+    void set_checkpoint(const std::string &path)
+    {
+        checkpoint = path;
+    }
 };
 
 class HeteroFractor : public FractorBase
@@ -30,6 +57,7 @@ class HeteroFractor : public FractorBase
 private:
     int fd;
     bool use_cpu;
+    std::unique_ptr<EcmPool> pool;
 
 public:
     bool handle
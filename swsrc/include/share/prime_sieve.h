@@ -0,0 +1,46 @@
+#ifndef PRIME_SIEVE_HEADER
+#define PRIME_SIEVE_HEADER
+
+#include <vector>
+
+#include "share/types.h"
+
+// Segmented sieve of Eratosthenes shared by the factorization algorithms.
+//     A segment holds only odd numbers, one bit each, and fits the L1
+//     cache. The multiples of 3, 5, 7, 11 and 13 are not sieved: every
+//     segment starts as a copy of a precomputed wheel pattern with them
+//     already removed, and only the larger primes are crossed off.
+
+// Generates primes from [from, to] in increasing order, one segment at a
+//     time. Memory depends only on the square root of 'to'.
+class PrimeStream
+{
+    // Bit i of 'bits' stands for lo + 2 * i
+    std::vector<uint8> bits;
+    uint64 lo;
+    uint64 from;
+    uint64 to;
+    usize pos;
+    // Index of the next prime below 17 to return, they are not sieved
+    usize small;
+
+    // Odd primes from 17 to the square root of 'to', with the index of
+    //     their next odd multiple past the current segment
+    std::vector<uint32> base;
+    std::vector<uint64> next_multiple;
+
+    // Sieves the segment at 'lo'
+    void fill();
+
+    public:
+        PrimeStream(uint64 from, uint64 to);
+
+        // Returns the next prime or 0 if there are no more primes
+        uint64 next();
+};
+
+// All primes of [from, to] in increasing order
+// nproc -- number of threads, each one sieves its own part of the range
+std::vector<uint32> sieve_primes(uint32 from, uint32 to, int32 nproc = 1);
+
+#endif // PRIME_SIEVE_HEADER
@@ -0,0 +1,262 @@
+#include "share/prime_sieve.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+// Odd numbers in a segment, one bit each, 32 KiB of L1 cache
+static constexpr uint64 SEGMENT_BITS = uint64(1) << 18;
+
+// The primes the wheel removes, and 2
+static constexpr uint32 SMALL_PRIMES[] = {2, 3, 5, 7, 11, 13};
+
+// 3 * 5 * 7 * 11 * 13, the period of the wheel in bytes. Byte k covers
+//     the odd numbers 2i + 1 for 8k <= i < 8k + 8, and 8 * WHEEL is a
+//     multiple of WHEEL, so byte k of any segment is wheel[k % WHEEL].
+static constexpr usize WHEEL = 15015;
+
+static const std::vector<uint8>& wheel()
+{
+    static const std::vector<uint8> pattern = [] {
+        std::vector<uint8> bytes(WHEEL, 0);
+        for (usize i = 0; i < 8 * WHEEL; ++i)
+        {
+            const uint64 num = 2 * i + 1;
+            bool coprime = true;
+            for (uint32 p : SMALL_PRIMES)
+            {
+                coprime = coprime && (p == 2 || num % p != 0);
+            }
+            if (coprime)
+            {
+                bytes[i / 8] |= 1 << (i % 8);
+            }
+        }
+        return bytes;
+    }();
+    return pattern;
+}
+
+// Odd primes from 17 to limit, sieved plainly, limit is the square
+//     root of the range so this is small
+static std::vector<uint32> base_primes(uint64 limit)
+{
+    std::vector<uint32> primes;
+    if (limit < 17)
+    {
+        return primes;
+    }
+    // composite[i] <=> 2i + 1 is composite
+    std::vector<bool> composite((limit + 1) / 2, false);
+    for (uint64 i = 1; 2 * i + 1 <= limit; ++i)
+    {
+        if (composite[i])
+        {
+            continue;
+        }
+        const uint64 p = 2 * i + 1;
+        for (uint64 j = (p * p - 1) / 2; 2 * j + 1 <= limit; j += p)
+        {
+            composite[j] = true;
+        }
+    }
+
+    // One allocation, the stage 1 of ECM counts them
+    primes.reserve(std::count(composite.begin() + 8, composite.end(), false));
+    for (uint64 i = 8; i < composite.size(); ++i)
+    {
+        if (!composite[i])
+        {
+            primes.push_back(2 * i + 1);
+        }
+    }
+    return primes;
+}
+
+PrimeStream::PrimeStream(uint64 from, uint64 to)
+    : lo(0)
+    , from(from)
+    , to(to)
+    , pos(0)
+    , small(0)
+{
+    if (to < from || to < 17)
+    {
+        return;
+    }
+
+    uint64 root = std::sqrt(static_cast<double>(to));
+    while (to / root < root)
+    {
+        --root;
+    }
+    while ((root + 1) <= to / (root + 1))
+    {
+        ++root;
+    }
+    base = base_primes(root);
+
+    // The first segment starts at a whole byte of the wheel
+    const uint64 first = (std::max<uint64>(from, 1) - 1) / 2 / 8 * 8;
+    lo = 2 * first + 1;
+    next_multiple.resize(base.size());
+    for (usize k = 0; k < base.size(); ++k)
+    {
+        // First odd multiple of p from max(p^2, lo) on, as an index
+        const uint64 p = base[k];
+        uint64 m = std::max(p * p, (lo + p - 1) / p * p);
+        if (m % 2 == 0)
+        {
+            m += p;
+        }
+        next_multiple[k] = (m - 1) / 2;
+    }
+    fill();
+}
+
+void PrimeStream::fill()
+{
+    const uint64 count = std::min(SEGMENT_BITS, (to - lo) / 2 + 1);
+    bits.resize((count + 7) / 8);
+
+    // Start from the wheel, it wraps around inside long segments
+    const std::vector<uint8>& pattern = wheel();
+    usize offset = (lo - 1) / 16 % WHEEL;
+    for (usize done = 0; done < bits.size(); )
+    {
+        const usize len = std::min(bits.size() - done, WHEEL - offset);
+        std::memcpy(bits.data() + done, pattern.data() + offset, len);
+        done += len;
+        offset = 0;
+    }
+    if (lo == 1)
+    {
+        bits[0] &= ~1; // 1 is not a prime
+    }
+    // Numbers past 'to' in the last byte
+    if (count % 8 != 0)
+    {
+        bits.back() &= (1 << (count % 8)) - 1;
+    }
+
+    const uint64 i0 = (lo - 1) / 2;
+    const uint64 i1 = i0 + count;
+    for (usize k = 0; k < base.size(); ++k)
+    {
+        const uint64 p = base[k];
+        uint64 j = next_multiple[k];
+        if (i1 <= j)
+        {
+            // Also true for every larger prime that starts at p^2
+            if (p * p > 2 * i1 + 1)
+            {
+                break;
+            }
+            continue;
+        }
+        for (; j < i1; j += p)
+        {
+            bits[(j - i0) / 8] &= ~(1 << ((j - i0) % 8));
+        }
+        next_multiple[k] = j;
+    }
+    pos = 0;
+}
+
+uint64 PrimeStream::next()
+{
+    while (small < std::size(SMALL_PRIMES))
+    {
+        const uint64 p = SMALL_PRIMES[small++];
+        if (from <= p && p <= to)
+        {
+            return p;
+        }
+    }
+
+    while (!bits.empty())
+    {
+        while (pos < 8 * bits.size())
+        {
+            const uint8 b = bits[pos / 8] >> (pos % 8);
+            if (b == 0)
+            {
+                pos = (pos / 8 + 1) * 8;
+                continue;
+            }
+            pos += __builtin_ctz(b);
+            const uint64 num = lo + 2 * pos++;
+            if (from <= num)
+            {
+                return num;
+            }
+        }
+
+        // The segment is done, is there another one
+        if (to < lo + 2 * SEGMENT_BITS)
+        {
+            bits.clear();
+            break;
+        }
+        lo += 2 * SEGMENT_BITS;
+        fill();
+    }
+    return 0;
+}
+
+std::vector<uint32> sieve_primes(uint32 from, uint32 to, int32 nproc)
+{
+    if (to < from)
+    {
+        return {};
+    }
+
+    // Every thread gets whole segments
+    const uint64 span = 2 * SEGMENT_BITS;
+    const uint64 length = uint64(to) - from + 1;
+    const uint64 parts = std::max<uint64>(
+        1,
+        std::min<uint64>(std::max(nproc, 1), (length + span - 1) / span)
+    );
+    const uint64 step = (length + parts - 1) / parts / span * span + span;
+
+    std::vector<std::vector<uint32>> found(parts);
+    auto sieve_part = [&](uint64 q) {
+        const uint64 lo = from + q * step;
+        if (to < lo)
+        {
+            return;
+        }
+        const uint64 hi = std::min<uint64>(to, lo + step - 1);
+        PrimeStream primes(lo, hi);
+        for (uint64 p = primes.next(); p != 0; p = primes.next())
+        {
+            found[q].push_back(p);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint64 q = 1; q < parts; ++q)
+    {
+        threads.emplace_back(sieve_part, q);
+    }
+    sieve_part(0);
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    usize total = 0;
+    for (const std::vector<uint32>& part : found)
+    {
+        total += part.size();
+    }
+    std::vector<uint32> primes;
+    primes.reserve(total);
+    for (const std::vector<uint32>& part : found)
+    {
+        primes.insert(primes.end(), part.begin(), part.end());
+    }
+    return primes;
+}
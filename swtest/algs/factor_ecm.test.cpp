@@ -1,10 +1,57 @@
 #include "algs/factor_ecm.h"
 
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <new>
+#include <string>
 #include <vector>
 
 #include "share/types.h"
 
+// Heap allocations of the process, by operator new and by GMP
+static std::atomic<int64> allocations{0};
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    if (void* p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+// Not inlined, or GCC pairs the free with the new of the caller and
+//     reports a mismatch
+[[gnu::noinline]] void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+static void* gmp_alloc(size_t size)
+{
+    ++allocations;
+    return std::malloc(size);
+}
+
+static void* gmp_realloc(void* p, size_t, size_t size)
+{
+    ++allocations;
+    return std::realloc(p, size);
+}
+
+static void gmp_free(void* p, size_t)
+{
+    std::free(p);
+}
+
 void print_array(const std::vector<intxx>& arr)
 {
     std::cout << "{\n";
@@ -82,27 +129,411 @@ void test1()
     }
 }
 
-void test2() {
-    // {intxx{"1000000028000000147"}, },
+// Explicit bounds and the processors count of the caller, a count
+//     below 1 runs on one processor
+void test2()
+{
     intxx n{"399078807775042581218909"};
-    std::vector<intxx> exp  = {1000000007, 1000000021};
+    std::vector<intxx> ans = {710134833337, 561976105157};
+
+    for (int32 procs : {4, 0})
+    {
+        std::atomic<bool> stop = false;
+        std::vector<intxx> ret = factor_ECM_parm(
+            n,
+            100000,
+            1000000,
+            40,
+            procs,
+            stop,
+            false // verbose
+        ).ret;
+        std::atomic<bool> stop_auto = false;
+        std::vector<intxx> ret_auto = factor_ECM_auto(
+            n,
+            procs,
+            stop_auto,
+            false // verbose
+        ).ret;
+        if (!comp_vec(ret, ans) || !comp_vec(ret_auto, ans))
+        {
+            std::cout << "Error in test" << std::endl;
+            std::cout << "  procs = " << procs << std::endl;
+            std::cout << "  ans = ";
+                print_array(ans);
+            std::cout << "  ret = ";
+                print_array(ret);
+            std::cout << "  ret_auto = ";
+                print_array(ret_auto);
+            break;
+        }
+    }
+}
+
+// Stage 1 on Edwards curves
+void test3()
+{
+    const std::vector<
+        std::pair<intxx, std::vector<intxx>>
+    > test_data {
+        {8051, {97, 83}},
+        {10967535067, {104729, 104723}},
+        {1279111203059, {1273471, 1004429}},
+        {intxx{"1000000028000000147"}, {1000000007, 1000000021}},
+    };
+
+    EcmPool pool(2);
+    for (const auto& [n, ans] : test_data)
+    {
+        std::atomic<bool> stop = false;
+        std::vector<intxx> ret = factor_ECM_parm(
+            n,
+            2000,
+            200000,
+            200,
+            ECM_DEFAULT_SEED,
+            pool,
+            stop,
+            false, // verbose
+            EcmCurveForm::edwards
+        ).ret;
+        if (!comp_vec(ret, ans))
+        {
+            std::cout << "Error in test" << std::endl;
+            std::cout << "  n = " << n << std::endl;
+            std::cout << "  ans = ";
+                print_array(ans);
+            std::cout << "  ret = ";
+                print_array(ret);
+            break;
+        }
+    }
+}
+
+// Curves extended from a small bound to a larger one
+void test4()
+{
+    intxx n{"1000000028000000147"};
+    std::vector<intxx> ans = {1000000007, 1000000021};
+
+    std::vector<Curve> curves;
+    intxx del;
+    generate_curves(n, ECM_DEFAULT_SEED, 0, 16, curves, del);
+    std::vector<EcmCurveState> states;
+    for (const Curve& curve : curves)
+    {
+        states.push_back({curve, curve.x0, 1, 1});
+    }
+
+    EcmPool pool(2);
+    std::vector<intxx> ret;
+    for (int64 B : {100, 1000, 10000})
+    {
+        std::atomic<bool> stop = false;
+        ret = factor_ECM_parm(n, B, 100 * B, states, pool, stop, false).ret;
+        if (!ret.empty())
+        {
+            break;
+        }
+        for (const EcmCurveState& state : states)
+        {
+            if (state.B != B)
+            {
+                std::cout << "Error in test: curve is not at B" << std::endl;
+                return;
+            }
+        }
+    }
+    if (!comp_vec(ret, ans))
+    {
+        std::cout << "Error in test" << std::endl;
+        std::cout << "  n = " << n << std::endl;
+        std::cout << "  ans = ";
+            print_array(ans);
+        std::cout << "  ret = ";
+            print_array(ret);
+    }
+}
+
+// A run saved to a checkpoint and read back
+void test5()
+{
+    // Two 100-bit primes, far out of reach of B = 1000
+    intxx n{"1267650600228229401496703205653"};
+    n *= intxx{"1267650600228229401496703205707"};
+    const std::string path = "factor_ecm.test.checkpoint";
+
+    std::vector<Curve> curves;
+    intxx del;
+    generate_curves(n, ECM_DEFAULT_SEED, 0, 16, curves, del);
+    std::vector<EcmCurveState> states;
+    for (const Curve& curve : curves)
+    {
+        states.push_back({curve, curve.x0, 1, 1});
+    }
+
+    EcmPool pool(2);
+    std::atomic<bool> stop = false;
+    factor_ECM_parm(n, 1000, 10000, states, pool, stop, false, path);
+
+    intxx loaded_n;
+    int64 B;
+    int64 B2;
+    std::vector<EcmCurveState> loaded;
+    bool ok = load_ecm_checkpoint(path, loaded_n, B, B2, loaded)
+           && loaded_n == n
+           && B == 1000
+           && B2 == 10000
+           && loaded.size() == states.size();
+    for (usize q = 0; ok && q < states.size(); ++q)
+    {
+        ok = loaded[q].curve.sigma == states[q].curve.sigma
+          && loaded[q].curve.A24 == states[q].curve.A24
+          && loaded[q].X == states[q].X
+          && loaded[q].Z == states[q].Z
+          && loaded[q].B == 1000
+          && loaded[q].B2 == 10000;
+    }
+    std::remove(path.c_str());
+    if (!ok)
+    {
+        std::cout << "Error in test: checkpoint does not match the run"
+                  << std::endl;
+    }
+}
+
+// Counters of a run that finds nothing: every curve goes through both
+//     stages
+void test6()
+{
+    intxx n{"1267650600228229401496703205653"};
+    n *= intxx{"1267650600228229401496703205707"};
+
+    EcmPool pool(2);
+    std::atomic<bool> stop = false;
+    FactorECMReturn ret = factor_ECM_parm(
+        n,
+        1000,
+        10000,
+        16,
+        ECM_DEFAULT_SEED,
+        pool,
+        stop,
+        false
+    );
+    const EcmStats& stats = ret.stats;
+    if (
+        !ret.ret.empty()
+        || stats.curves_started != 16
+        || stats.curves_completed != 16
+        || stats.gcds < 32
+        || stats.mulmods <= 0
+        || stats.stage1_wall <= 0
+        || stats.stage2_wall <= 0
+    )
+    {
+        std::cout << "Error in test: wrong counters" << std::endl;
+        std::cout << "  started = " << stats.curves_started
+                  << "  completed = " << stats.curves_completed
+                  << "  gcds = " << stats.gcds
+                  << "  mulmods = " << stats.mulmods
+                  << std::endl;
+    }
+}
+
+// Stage 1 allocates only in its setup and warm-up: a run to a large
+//     bound allocates as often as a run to a small one. Both a
+//     fixed-width Montgomery field and the mpz field are checked.
+void test7()
+{
+    mp_set_memory_functions(gmp_alloc, gmp_realloc, gmp_free);
+
+    intxx big = 1;
+    big <<= 1100;
+    mpz_nextprime(big.get_mpz_t(), big.get_mpz_t());
+    const std::vector<std::pair<intxx, int64>> cases = {
+        {intxx{"1267650600228229401496703205653"}, 100000},
+        {big, 5000},
+    };
+    for (const auto& [n, B] : cases)
+    {
+        std::vector<Curve> curves;
+        intxx del;
+        generate_curves(n, ECM_DEFAULT_SEED, 0, 1, curves, del);
+        std::atomic<bool> stop = false;
+        int64 counts[2];
+        for (int32 q = 0; q < 2; ++q)
+        {
+            EcmCurveState state{curves[0], curves[0].x0, 1, 1};
+            const int64 before = allocations;
+            ecm_stage1(n, state, q == 0 ? B / 10 : B, stop);
+            counts[q] = allocations - before;
+        }
+        if (counts[0] != counts[1])
+        {
+            std::cout << "Error in test: stage 1 allocates, "
+                      << counts[0] << " allocations to B / 10, "
+                      << counts[1] << " to B" << std::endl;
+        }
+    }
+}
+
+// Edwards curves built together are the ones built one by one
+void test8()
+{
+    intxx n{"1267650600228229401496703205653"};
+    n *= intxx{"1267650600228229401496703205707"};
+
+    std::vector<EdwardsCurve> curves;
+    intxx del;
+    bool ok = generate_edwards_curves(n, ECM_DEFAULT_SEED, 0, 16, curves, del)
+           && curves.size() == 16;
+    for (usize q = 0; ok && q < curves.size(); ++q)
+    {
+        EdwardsCurve curve;
+        ok = generate_edwards_curve(n, ECM_DEFAULT_SEED, q, curve, del)
+          && curve.x0 == curves[q].x0
+          && curve.y0 == curves[q].y0
+          && curve.d == curves[q].d
+          && curve.mont.x0 == curves[q].mont.x0
+          && curve.mont.A24 == curves[q].mont.A24;
+    }
+    if (!ok)
+    {
+        std::cout << "Error in test: batch of Edwards curves differs"
+                  << std::endl;
+    }
+}
+
+// Numbers of different sizes factored in one run
+void test9()
+{
+    const std::vector<intxx> numbers = {
+        intxx{"1000000028000000147"},
+        intxx{"60182085492692676951488498761"},
+        intxx{"8051"},
+        intxx{"399078807775042581218909"},
+        intxx{"1000000028000000147"},
+    };
+
+    EcmPool pool(2);
     std::atomic<bool> stop = false;
-    auto ret = factor_ECM_parm(
+    FactorECMManyReturn ret = factor_ECM_many(numbers, pool, stop, false);
+    for (usize q = 0; q < numbers.size(); ++q)
+    {
+        const std::vector<intxx>& factors = ret.ret[q].ret;
+        if (
+            factors.size() != 2
+            || factors[0] == 1
+            || factors[1] == 1
+            || factors[0] * factors[1] != numbers[q]
+        )
+        {
+            std::cout << "Error in test" << std::endl;
+            std::cout << "  n = " << numbers[q] << std::endl;
+            std::cout << "  ret = ";
+                print_array(factors);
+        }
+    }
+}
+
+// Every stage 1 kernel the processor has finds the factors the widest
+//     one finds
+void test10()
+{
+    const std::vector<
+        std::pair<intxx, std::vector<intxx>>
+    > test_data {
+        {intxx{"1000000028000000147"}, {1000000007, 1000000021}},
+        {
+            intxx{"399078807775042581218909"},
+            {710134833337, 561976105157}
+        },
+    };
+
+    EcmPool pool(2);
+    for (const auto& [n, ans] : test_data)
+    {
+        for (EcmKernel kernel : {
+            EcmKernel::ifma,
+            EcmKernel::avx2,
+            EcmKernel::scalar,
+        })
+        {
+            if (!ecm_kernel_supported(kernel))
+            {
+                continue;
+            }
+            set_ecm_kernel(kernel);
+            std::atomic<bool> stop = false;
+            std::vector<intxx> ret = factor_ECM_parm(
+                n,
+                5000,
+                500000,
+                64,
+                ECM_DEFAULT_SEED,
+                pool,
+                stop,
+                false // verbose
+            ).ret;
+            if (!comp_vec(ret, ans))
+            {
+                std::cout << "Error in test" << std::endl;
+                std::cout << "  kernel = " << int(kernel) << std::endl;
+                std::cout << "  n = " << n << std::endl;
+                std::cout << "  ans = ";
+                    print_array(ans);
+                std::cout << "  ret = ";
+                    print_array(ret);
+                break;
+            }
+        }
+    }
+    set_ecm_kernel(EcmKernel::automatic);
+}
+
+// A pool asked for no threads still runs the curves on one
+void test11()
+{
+    intxx n{"1000000028000000147"};
+    std::vector<intxx> ans = {1000000007, 1000000021};
+
+    EcmPool pool(0);
+    std::atomic<bool> stop = false;
+    std::vector<intxx> ret = factor_ECM_parm(
         n,
-        100000,
-        10,
-        5,
+        2000,
+        200000,
+        50,
+        ECM_DEFAULT_SEED,
+        pool,
         stop,
-        true // verbose
+        false // verbose
     ).ret;
-    std::cout << "ret = "; print_array(ret);
-    std::cout << "exp = "; print_array(exp);
+    if (pool.size() != 1 || !comp_vec(ret, ans))
+    {
+        std::cout << "Error in test" << std::endl;
+        std::cout << "  pool.size() = " << pool.size() << std::endl;
+        std::cout << "  ans = ";
+            print_array(ans);
+        std::cout << "  ret = ";
+            print_array(ret);
+    }
 }
 
 int main()
 {
     test1();
-    // test2();
+    test2();
+    test3();
+    test4();
+    test5();
+    test6();
+    test7();
+    test8();
+    test9();
+    test10();
+    test11();
 
     return 0;
 }
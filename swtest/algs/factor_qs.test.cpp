@@ -1,6 +1,7 @@
 #include "algs/factor_qs.h"
 
 #include <iostream>
+#include <tuple>
 #include <vector>
 
 #include "share/types.h"
@@ -103,10 +104,78 @@ void test2() {
     }
 }
 
+// Sizes where the polynomials of SIQS are switched
+void test3()
+{
+    const std::vector<
+        std::pair<intxx, std::vector<intxx>>
+    > test_data {
+        {
+            intxx{"22557563476733397557"},
+            {intxx{"5942859581"}, intxx{"3795742297"}}
+        },
+        {
+            intxx{"112317932202943735387945909397"},
+            {intxx{"570820472448937"}, intxx{"196765774221581"}}
+        },
+        {
+            intxx{"2092533481154870832299523575806001957951"},
+            {intxx{"27482144350526720249"}, intxx{"76141565027285271799"}}
+        },
+    };
+
+    for (const auto& [n, ans] : test_data)
+    {
+        std::vector<intxx> ret = factor_QS(n);
+        if (!comp_vec(ret, ans))
+        {
+            std::cout << "Error in test" << std::endl;
+            std::cout << "  n = " << n << std::endl;
+            std::cout << "  ans = ";
+                print_array(ans);
+            std::cout << "  ret = ";
+                print_array(ret);
+            break;
+        }
+    }
+}
+
+// Squares of primes, no congruence of squares splits them
+void test4()
+{
+    const std::vector<
+        std::pair<intxx, std::vector<intxx>>
+    > test_data {
+        {intxx{"121"}, {intxx{"11"}, intxx{"11"}}},
+        {intxx{"54289"}, {intxx{"233"}, intxx{"233"}}},
+        {
+            intxx{"18446744030759878681"},
+            {intxx{"4294967291"}, intxx{"4294967291"}}
+        },
+    };
+
+    for (const auto& [n, ans] : test_data)
+    {
+        std::vector<intxx> ret = factor_QS(n);
+        if (!comp_vec(ret, ans))
+        {
+            std::cout << "Error in test" << std::endl;
+            std::cout << "  n = " << n << std::endl;
+            std::cout << "  ans = ";
+                print_array(ans);
+            std::cout << "  ret = ";
+                print_array(ret);
+            break;
+        }
+    }
+}
+
 int main()
 {
     test1();
     // test2();
+    test3();
+    test4();
 
     return 0;
 }